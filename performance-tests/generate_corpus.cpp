@@ -0,0 +1,138 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Generates a reproducible corpus of synthetic JPEG photos for the scaling benchmark.
+ * Every photo gets a colour gradient and a few random blocks, so that the photos
+ * rasterize differently, and a share of them is stored rotated with a matching
+ * EXIF orientation tag.
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <boost/gil/image.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <boost/gil/extension/io/jpeg_dynamic_io.hpp>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/cstdint.hpp>
+
+#include <exiv2/image.hpp>
+
+namespace gil = boost::gil;
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using boost::lexical_cast;
+
+const int ROTATED_ORIENTATIONS[] = { 3, 6, 8 };
+const int BLOCKS_PER_PHOTO = 6;
+
+program_options::variables_map parse_command_line(int argc, char** argv)
+{
+    program_options::options_description options_description("Options for generate-corpus");
+    options_description.add_options()
+        ("help,h", "Prints this help.")
+        ("output-dir", program_options::value<string>(), "Directory the photos are written to. It is created if necessary.")
+        ("count", program_options::value<int>()->default_value(1000), "Number of photos to generate.")
+        ("width", program_options::value<int>()->default_value(1600), "Width of the photos as they are to be displayed.")
+        ("height", program_options::value<int>()->default_value(1200), "Height of the photos as they are to be displayed.")
+        ("rotated-percentage", program_options::value<int>()->default_value(25), "Percentage of photos that are stored rotated with an EXIF orientation tag.")
+        ("seed", program_options::value<unsigned int>()->default_value(1), "Seed for the random generator. The same seed always gives the same corpus.");
+    program_options::variables_map result;
+    program_options::store(program_options::parse_command_line(argc, argv, options_description), result);
+    program_options::notify(result);
+    if(result.count("help") or not result.count("output-dir"))
+    {
+        cout << options_description << endl;
+        exit(result.count("help") ? 0 : 1);
+    }
+    // paint_photo() places blocks of up to half the photo's width and height.
+    if(result["width"].as<int>() < 2 or result["height"].as<int>() < 2)
+    {
+        cerr << "width and height must be at least 2." << endl;
+        exit(1);
+    }
+    return result;
+}
+
+void paint_photo(const gil::rgb8_view_t& view)
+{
+    int red = rand() % 256, green = rand() % 256, blue = rand() % 256;
+    for(int y = 0; y < view.height(); ++y)
+    {
+        for(int x = 0; x < view.width(); ++x)
+        {
+            view(x, y) = gil::rgb8_pixel_t((red + 128 * x / view.width()) % 256,
+                                           (green + 128 * y / view.height()) % 256,
+                                           (blue + 64 * (x + y) / (view.width() + view.height())) % 256);
+        }
+    }
+    for(int block = 0; block < BLOCKS_PER_PHOTO; ++block)
+    {
+        int block_width = 1 + rand() % (view.width() / 2);
+        int block_height = 1 + rand() % (view.height() / 2);
+        gil::fill_pixels(gil::subimage_view(view, rand() % (view.width() - block_width + 1), rand() % (view.height() - block_height + 1),
+                block_width, block_height), gil::rgb8_pixel_t(rand() % 256, rand() % 256, rand() % 256));
+    }
+}
+
+void write_orientation(const string& path, int orientation)
+{
+    Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(path);
+    image->readMetadata();
+    Exiv2::ExifData& exif_data = image->exifData();
+    exif_data["Exif.Image.Orientation"] = boost::uint16_t(orientation);
+    image->writeMetadata();
+}
+
+int main(int argc, char** argv)
+{
+    program_options::variables_map input = parse_command_line(argc, argv);
+    string output_dir = input["output-dir"].as<string>();
+    int width = input["width"].as<int>();
+    int height = input["height"].as<int>();
+    filesystem::create_directories(output_dir);
+    srand(input["seed"].as<unsigned int>());
+
+    for(int i = 0; i < input["count"].as<int>(); ++i)
+    {
+        string path = output_dir + "/photo" + lexical_cast<string>(i) + ".jpg";
+        bool rotated = rand() % 100 < input["rotated-percentage"].as<int>();
+        int orientation = rotated ? ROTATED_ORIENTATIONS[rand() % 3] : 1;
+        bool swapped = orientation == 6 or orientation == 8;
+
+        // The pixels are stored as a camera would store them: still to be rotated by the viewer.
+        gil::rgb8_image_t photo(swapped ? height : width, swapped ? width : height);
+        paint_photo(view(photo));
+        gil::jpeg_write_view(path, view(photo), 90);
+        if(rotated)
+        {
+            write_orientation(path, orientation);
+        }
+    }
+    cout << "Generated " << input["count"].as<int>() << " photos in " << output_dir << endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# Reproducible end-to-end scaling benchmark for phomo.
+#
+# Generates a synthetic photo corpus, then runs build-database and render over a
+# matrix of settings and records wall time, CPU time and peak memory of every run
+# in a CSV file, together with the speedup over the single-threaded run. Renders with
+# the approximate search also record its recall, measured in a separate run that is
+# not timed, because measuring it runs the exact search as well.
+#
+# All settings can be overridden from the environment, e.g.
+#
+#     THREADS="1 2 4" CORPUS_SIZE=500 ./scaling_benchmark.sh
+#
+# Reports are named after the current commit, so runs of different commits can be
+# compared side by side.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+GENERATE_CORPUS=${GENERATE_CORPUS:-$HERE/generate-corpus}
+WORK_DIR=${WORK_DIR:-$HERE/benchmark-work}
+RESULTS_DIR=${RESULTS_DIR:-$HERE/results}
+
+CORPUS_SIZE=${CORPUS_SIZE:-2000}
+PHOTO_WIDTH=${PHOTO_WIDTH:-1600}
+PHOTO_HEIGHT=${PHOTO_HEIGHT:-1200}
+ROTATED_PERCENTAGE=${ROTATED_PERCENTAGE:-25}
+SEED=${SEED:-1}
+
+THREADS=${THREADS:-"1 2 3 4 6 8"}
+RASTER_RESOLUTIONS=${RASTER_RESOLUTIONS:-"3 5"}
+X_RESOLUTIONS_IN_STONES=${X_RESOLUTIONS_IN_STONES:-"20 60"}
+MIN_DISTANCES=${MIN_DISTANCES:-"0 5"}
+# 0 is the exact search, every other value renders with that many index lists searched.
+SEARCH_PROBES=${SEARCH_PROBES:-"0 4"}
+INDEX_LISTS=${INDEX_LISTS:-32}
+OUTPUT_WIDTH=${OUTPUT_WIDTH:-2048}
+GNU_TIME=${GNU_TIME:-/usr/bin/time}
+
+if [ ! -x "$GNU_TIME" ]; then
+    echo "GNU time ($GNU_TIME) is required." >&2
+    exit 1
+fi
+
+COMMIT=$(git -C "$HERE" rev-parse --short HEAD 2>/dev/null || echo unknown)
+mkdir -p "$WORK_DIR" "$RESULTS_DIR"
+REPORT=$RESULTS_DIR/scaling-$COMMIT.csv
+RAW_REPORT=$WORK_DIR/raw.csv
+
+CORPUS_DIR=$WORK_DIR/corpus-$CORPUS_SIZE-${PHOTO_WIDTH}x$PHOTO_HEIGHT-$ROTATED_PERCENTAGE-$SEED
+if [ ! -d "$CORPUS_DIR" ]; then
+    "$GENERATE_CORPUS" --output-dir "$CORPUS_DIR" --count "$CORPUS_SIZE" --width "$PHOTO_WIDTH" \
+        --height "$PHOTO_HEIGHT" --rotated-percentage "$ROTATED_PERCENTAGE" --seed "$SEED"
+fi
+PICTURE=$CORPUS_DIR/photo0.jpg
+
+# measure <action> <threads> <raster-resolution> <x-resolution> <min-distance> <search-probes> <phomo arguments...>
+# Records $recall with the run, which is - unless measure_recall set it.
+measure()
+{
+    action=$1 threads=$2 raster_resolution=$3 x_resolution=$4 min_distance=$5 search_probes=$6
+    shift 6
+    echo "$action threads=$threads raster-resolution=$raster_resolution x-resolution-in-stones=$x_resolution min-distance=$min_distance search-probes=$search_probes"
+    "$GNU_TIME" -f "%e,%U,%S,%M" -o "$WORK_DIR/time" "$PHOMO" "$action" --number-of-threads "$threads" "$@" > "$WORK_DIR/phomo.log"
+    echo "$action,$threads,$raster_resolution,$x_resolution,$min_distance,$search_probes,$(cat "$WORK_DIR/time"),$recall" >> "$RAW_REPORT"
+}
+
+# measure_recall <phomo render arguments...> sets $recall to the recall in percent render reports.
+measure_recall()
+{
+    "$PHOMO" render --benchmark-recall "$@" > "$WORK_DIR/recall.log"
+    recall=$(sed -n 's/^Recall of the approximate search: \(.*\)%$/\1/p' "$WORK_DIR/recall.log")
+}
+
+: > "$RAW_REPORT"
+for raster_resolution in $RASTER_RESOLUTIONS; do
+    database=$WORK_DIR/database-$raster_resolution
+    recall=-
+    for threads in $THREADS; do
+        measure build-database "$threads" "$raster_resolution" - - - --input-type directory --photos-dir "$CORPUS_DIR" \
+            --raster-resolution "$raster_resolution" --database-filename "$database"
+    done
+    "$PHOMO" build-index --database-filename "$database" --index-lists "$INDEX_LISTS" > /dev/null
+    for x_resolution in $X_RESOLUTIONS_IN_STONES; do
+        for min_distance in $MIN_DISTANCES; do
+            for search_probes in $SEARCH_PROBES; do
+                render_arguments="--database-filename $database --picture-path $PICTURE --output-filename $WORK_DIR/mosaic.jpg
+                    --output-width $OUTPUT_WIDTH --x-resolution-in-stones $x_resolution --min-distance $min_distance
+                    --search-probes $search_probes"
+                recall=-
+                if [ "$search_probes" -gt 0 ]; then
+                    measure_recall $render_arguments
+                fi
+                for threads in $THREADS; do
+                    measure render "$threads" "$raster_resolution" "$x_resolution" "$min_distance" "$search_probes" $render_arguments
+                done
+            done
+        done
+    done
+done
+
+# Speedup is relative to the run with the fewest threads of the same configuration.
+echo "commit,action,threads,raster_resolution,x_resolution_in_stones,min_distance,search_probes,wall_seconds,user_seconds,system_seconds,peak_rss_kb,recall_percent,speedup" > "$REPORT"
+awk -F, -v commit="$COMMIT" '
+    NR == FNR {
+        configuration = $1 "," $3 "," $4 "," $5 "," $6
+        if (!(configuration in fewest_threads) || $2 + 0 < fewest_threads[configuration]) {
+            fewest_threads[configuration] = $2 + 0
+            baseline[configuration] = $7
+        }
+        next
+    }
+    {
+        configuration = $1 "," $3 "," $4 "," $5 "," $6
+        speedup = ($7 > 0) ? baseline[configuration] / $7 : 0
+        printf "%s,%s,%.2f\n", commit, $0, speedup
+    }' "$RAW_REPORT" "$RAW_REPORT" >> "$REPORT"
+
+echo "Report written to $REPORT"
@@ -16,1077 +16,212 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+/*
+ * The actions of the phomo command line, which phomo_actions.h declares.
+ */
 
-#include <iostream>
-#include <map>
-#include <fstream>
-#include <stdexcept>
-#include <vector>
-#include <list>
-#include <math.h>
-#include <sstream>
-#include <algorithm>
-#include <string>
-
-#include <boost/gil/image.hpp>
-#include <boost/gil/typedefs.hpp>
-
-#include <boost/gil/extension/io/jpeg_dynamic_io.hpp>
-#include <boost/gil/extension/numeric/sampler.hpp>
-#include <boost/gil/extension/numeric/resample.hpp>
-#include <boost/program_options.hpp>
-#include <boost/lambda/lambda.hpp>
-#include <boost/filesystem.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/thread.hpp>
-#include <boost/thread/mutex.hpp>
-#include <boost/timer.hpp>
-#include <boost/foreach.hpp>
-
-#include <exiv2/image.hpp>
-
-namespace gil = boost::gil;
-namespace lambda = boost::lambda;
-namespace program_options = boost::program_options;
-namespace filesystem = boost::filesystem;
-
-
-using std::string;
-using std::cout;
-using std::cerr;
-using std::map;
-using std::list;
-using std::endl;
-using std::ofstream;
-using std::ifstream;
-using std::vector;
-using std::ptrdiff_t;
-using std::pair;
-using boost::algorithm::iends_with;
-using boost::lexical_cast;
-using boost::algorithm::split;
-using boost::algorithm::is_any_of;
-
-
-const int NUMBER_OF_CHANNELS = 3;
-
-const int RED_CHANNEL_INDEX = 0;
-const int GREEN_CHANNEL_INDEX = 1;
-const int BLUE_CHANNEL_INDEX = 2;
-
-enum Orientation { NOT_ROTATED = 1, ROTATED_180 = 3, ROTATED_90CCW = 6, ROTATED_90CW = 8 };
-
-program_options::options_description visible_options_description()
-{
-    program_options::options_description options_description;
-
-    options_description.add_options()
-        ("help,h", "Prints this help.")
-        ("version,v", "Prints version information.");
-    program_options::options_description shared_options("Options shared between build-database and render");
-    shared_options.add_options()
-        ("database-filename", program_options::value<string>(), "The filename for the photos database.");
-    program_options::options_description build_database_options("Options allowed for build-database");
-    build_database_options.add_options()
-        ("input-type", program_options::value<string>(), "Specifies the input type. Allowed values: directory | file.")
-        ("photos-dir", program_options::value<string>(), "Top-directory which will be recursively traversed to build mosaic stones database.")
-        ("photos-file", program_options::value<string>(), "File that contains a list of image file paths to be used as mosaic stones. A \"-\" uses standard input instead of a file.")
-        ("aspect-ratio", program_options::value<string>()->default_value("1"), "Aspect ratio which should be used for the mosaic stones. Either WidthxHeight or a real number.")
-        ("raster-resolution", program_options::value<int>()->default_value(3), "Resolution of the rasterization the algorithm should internally use.");
-    program_options::options_description render_options("Options allowed for render");
-    render_options.add_options()
-        ("picture-path", program_options::value<string>(), "Path of the input pictures that is to be mosaicized.")
-        ("output-width", program_options::value<int>()->default_value(1024), "Pixel resolution of the resulting photo mosaic.")
-        ("x-resolution-in-stones", program_options::value<int>()->default_value(10), "Resolution of the resulting photo mosaic measured in mosaic stones.")
-        ("min-distance", program_options::value<int>()->default_value(10), "The minimum distance in which identical stones are allowed to appear.")
-        ("number-of-threads", program_options::value<int>()->default_value(4), "Fine tune control over number of threads to use.")
-        ("print-time-left", "Print time left to complete instead of progress in percentage.")
-        ("output-filename", program_options::value<string>(), "Image file path for the resulting photo mosaic.");
-    options_description.add(shared_options);
-    options_description.add(build_database_options);
-    options_description.add(render_options);
-    return options_description;
-}
-
-program_options::options_description full_options_description()
-{
-    program_options::options_description action;
-
-    action.add_options()
-        ("action", program_options::value<string>(), "Allowed values: build-database | render.\n"
-                                                     "build-database will build up a database of mosaic stones to use.\n"
-                                                     "render will use an existing mosaic stones database to render a picture.");
-    action.add(visible_options_description());
-    return action;
-
-}
-
-program_options::variables_map parse_command_line(int argc, char** argv)
-{
-    program_options::options_description options_description = full_options_description();
-
-    program_options::positional_options_description pos_options_desc;
-    pos_options_desc.add("action", 1);
-
-    program_options::variables_map result;
-    program_options::store(program_options::command_line_parser(argc, argv).options(options_description).positional(
-            pos_options_desc).run(), result);
-    program_options::notify(result);
-    return result;
-}
-
-
-unsigned char get_average_value(const gil::gray8_step_view_t& source_view)
-{
-    long sum = 0;
-    gil::for_each_pixel(source_view, sum += lambda::_1);
-    return sum / source_view.size();
-}
-
-template<int channel_index, class View>
-int average_raster_value(const View& source_view, int col, int row, int raster_width, int raster_height)
-{
-    gil::gray8_step_view_t sub_view(gil::subimage_view(gil::kth_channel_view<channel_index>(source_view), col * raster_width, row
-            * raster_height, raster_width, raster_height));
-    return get_average_value(sub_view);
-}
+#include "phomo_actions.h"
+#include "render.h"
 
-template<class View>
-void raster_values_from_view(const View& source_view, int col_count, int row_count, vector<int>& raster_values)
+vector<int> int_list_from_input(const string& input)
 {
-    assert(raster_values.size() == (size_t)(col_count*row_count*NUMBER_OF_CHANNELS));
-    typename View::x_coord_t raster_width = source_view.width() / col_count;
-    typename View::y_coord_t raster_height = source_view.height() / row_count;
-
-    for (int y = 0; y < row_count; ++y)
+    vector<string> parts;
+    split(parts, input, is_any_of(","));
+    vector<int> values;
+    BOOST_FOREACH(const string& part, parts)
     {
-        for (int x = 0; x < col_count; ++x)
+        if(not part.empty())
         {
-            raster_values[x + y*col_count + RED_CHANNEL_INDEX*col_count*row_count] =
-                average_raster_value<RED_CHANNEL_INDEX>(source_view, x,y, raster_width, raster_height);
-            raster_values[x + y*col_count + GREEN_CHANNEL_INDEX*col_count*row_count] =
-                average_raster_value<GREEN_CHANNEL_INDEX>(source_view, x,y, raster_width, raster_height);
-            raster_values[x + y*col_count + BLUE_CHANNEL_INDEX*col_count*row_count] =
-                average_raster_value<BLUE_CHANNEL_INDEX>(source_view, x,y, raster_width, raster_height);
+            values.push_back(lexical_cast<int>(part));
         }
     }
+    return values;
 }
 
-Orientation orientation_from_image_path(const string& path)
-{
-    Exiv2::Image::AutoPtr exif_image = Exiv2::ImageFactory::open(path);
-    exif_image->readMetadata();
-    Exiv2::ExifData &exifData = exif_image->exifData();
-    if(exifData.empty())
-    {
-        return NOT_ROTATED;
-    }
-    switch (exifData["Exif.Image.Orientation"].toLong())
-    {
-    case 1:
-        return NOT_ROTATED;
-    case 3:
-        return ROTATED_180;
-    case 6:
-        return ROTATED_90CCW;
-    case 8:
-        return ROTATED_90CW;
-    default:
-        return NOT_ROTATED;
-    }
-
-}
-
-typedef gil::point2<std::ptrdiff_t> Dimensions;
-typedef gil::point2<std::ptrdiff_t> Position;
-
-void swap(gil::point2<std::ptrdiff_t>& dimensions)
-{
-    std::ptrdiff_t help = dimensions.x;
-    dimensions.x = dimensions.y;
-    dimensions.y = help;
-}
-
-gil::point2<std::ptrdiff_t> aspect_ratio_cropped_dimensions(const string& current_path, double aspect_ratio, Orientation orientation)
-{
-    gil::point2<std::ptrdiff_t> dimensions = gil::jpeg_read_dimensions(current_path);
-    if (orientation == ROTATED_90CCW or orientation == ROTATED_90CW)
-    {
-        swap(dimensions);
-    }
-    if(dimensions.x/aspect_ratio > dimensions.y)
-    {
-        dimensions.x = dimensions.y*aspect_ratio;
-    }
-    else
-    {
-        dimensions.y = dimensions.x/aspect_ratio;
-    }
-    return dimensions;
-}
-
-class Timer
-{
-    boost::timer timer_;
-public:
-    void restart() {
-#ifdef PHOMO_TIMER
-        timer_.restart();
-#endif
-    }
-    void print_elapsed_with_label(const string& label)
-    {
-#ifdef PHOMO_TIMER
-        cout << label << ": " << timer_.elapsed() << "seconds" << endl;
-#endif
-    }
-} timer;
-
-
-class MosaicStone
-{
-    string image_file_path_;
-    vector<int> raster_values_;
-    int id_;
-public:
-    MosaicStone() {}
-    MosaicStone(const string &image_file_path, const vector<int>& raster_values, int id) :
-        image_file_path_(image_file_path),
-        raster_values_(raster_values),
-        id_(id) { }
-
-    MosaicStone(const string &image_file_path, int col_count, int row_count, double aspect_ratio) :
-        image_file_path_(image_file_path),
-        raster_values_(col_count*row_count*NUMBER_OF_CHANNELS, 0)
-    {
-        timer.restart();
-        Orientation orientation = orientation_from_image_path(image_file_path);
-        gil::point2<std::ptrdiff_t> dimensions = aspect_ratio_cropped_dimensions(image_file_path, aspect_ratio, orientation);
-
-        gil::rgb8_image_t source_image;
-        gil::jpeg_read_and_convert_image(image_file_path, source_image);
-        gil::rgb8_view_t source_view = view(source_image);
-        timer.print_elapsed_with_label("Load image");
-        timer.restart();
-        switch(orientation)
-        {
-        case NOT_ROTATED:
-            raster_values_from_view(/*gil::subsampled_view(*/gil::subimage_view(source_view, 0, 0, dimensions.x, dimensions.y)/*, 5, 5)*/, col_count, row_count, raster_values_);
-            break;
-        case ROTATED_180:
-            raster_values_from_view(/*gil::subsampled_view(*/gil::subimage_view(rotated180_view(source_view), 0, 0, dimensions.x, dimensions.y)/*, 5, 5)*/, col_count, row_count, raster_values_);
-            break;
-        case ROTATED_90CCW:
-            raster_values_from_view(/*gil::subsampled_view(*/gil::subimage_view(rotated90cw_view(source_view), 0, 0, dimensions.x, dimensions.y)/*, 5, 5)*/, col_count, row_count, raster_values_);
-            break;
-        case ROTATED_90CW:
-            raster_values_from_view(/*gil::subsampled_view(*/gil::subimage_view(rotated90ccw_view(source_view), 0, 0, dimensions.x, dimensions.y)/*, 5, 5)*/, col_count, row_count, raster_values_);
-            break;
-        }
-        timer.print_elapsed_with_label("raster_value_from_view");
-    }
-
-    void set_id(int id) { id_=id; }
-    int id() const { return id_; }
-
-    const string& image_file_path() const { return image_file_path_; }
-
-    int operator[](int index) const { return raster_values_[index]; }
-//    vector<int>& operator[](int index) { return raster_values_[index]; }
-
-    int calc_deviation(const vector<int>& b, int best_deviation) const
-    {
-        assert(raster_values_.size() == b.size());
-        int deviation = 0;
-        for(size_t i=0; i<raster_values_.size();++i)
-        {
-            deviation += (raster_values_[i]-b[i])*(raster_values_[i]-b[i]);
-
-            if(deviation>=best_deviation and best_deviation!=-1)
-            {
-                return -1;
-            }
-        }
-        return deviation;
-    }
-};
-
-typedef boost::shared_ptr<MosaicStone> MosaicStonePtr;
-
-class MosaicsDatabase
-{
-public:
-    MosaicsDatabase(const string& db_filename) /*:
-        file_(db_filename.c_str(), std::ios_base::in)*/
-    {
-        file_.open(db_filename.c_str(), std::ios_base::in);
-        file_ >> aspect_ratio_;
-        file_ >> raster_resolution_;
-        string line;
-        std::getline(file_, line);
-        int line_number = 1;
-        while(!file_.eof())
-        {
-            std::getline(file_, line);
-            if(line == "")
-            {
-                continue;
-            }
-            cout << line << endl;
-            vector<string> parts;
-            split(parts, line, is_any_of("|"));
-
-            string image_file_path = parts[0];
-            vector<int> values(raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS);
-            for(int i=0;i<raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS;++i)
-            {
-                values[i] = lexical_cast<int>(parts[i+1]);
-            }
-            stones_.push_back(MosaicStonePtr(new MosaicStone(image_file_path, values, line_number)));
-            line_number++;
-        }
-    }
-
-    MosaicsDatabase(const string& db_filename, double aspect_ratio, int raster_resolution) :
-        file_(db_filename.c_str(), std::ios_base::out | std::ios_base::trunc), raster_resolution_(raster_resolution), aspect_ratio_(aspect_ratio),
-        cached_raster_value_count_(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS)
-    {
-        file_ << aspect_ratio << endl;
-        file_ << raster_resolution << endl;
-    }
-
-    double aspect_ratio() const { return aspect_ratio_; }
-
-    double raster_resolution() const { return raster_resolution_; }
-
-    void add_mosaic_stone(MosaicStonePtr mosaic_stone)
-    {
-        boost::mutex::scoped_lock lock(io_mutex);
-        file_ << mosaic_stone->image_file_path();
-        for(int i=0; i < cached_raster_value_count_; ++i)
-        {
-            file_ << "|" << (*mosaic_stone)[i];
-        }
-        file_ << endl;
-        stones_.push_back(mosaic_stone);
-    }
-
-    const list<MosaicStonePtr>& stones() const { return stones_; }
-
-private:
-    std::fstream file_;
-    list<MosaicStonePtr> stones_;
-    int raster_resolution_;
-    double aspect_ratio_;
-    int cached_raster_value_count_;
-    boost::mutex io_mutex;
-};
-
+void non_deleter(std::istream* p) {}
 
-void add_mosaic_stone_to_database(MosaicsDatabase* mosaics_database, int i, const string& current_path, int col_count, int row_count, double aspect_ratio)
+ImageFilePathIteratorPtr createImageFilePathIterator(const program_options::variables_map& input)
 {
-    std::stringstream output;
-    output << i << "(thread-id: " <<  boost::this_thread::get_id() << ") "<< " " << current_path << " ... ";
-    try
-    {
-        mosaics_database->add_mosaic_stone(MosaicStonePtr(new MosaicStone(current_path, col_count, row_count, aspect_ratio)));
-        output << "Added" << std::endl;
-        cout << output.str();
-    }
-    catch(std::exception& error)
+    if(input["input-type"].as<string>() == "directory")
     {
-        output << "Error: " << error.what() << " ==> skipping" << std::endl;
-        cerr << output.str();
+        return ImageFilePathIteratorPtr(new ParallelDirectoryImageFilePathIterator(input["photos-dir"].as<string> (),
+                input["discovery-threads"].as<int>()));
     }
-    catch(...)
+    else if (input["input-type"].as<string>() == "file")
     {
-        output << "Unknown error ==> skipping" << std::endl;
-        cerr << output.str();
-    }
-}
-
-
-class ImageFilePathIterator
-{
-public:
-    virtual ~ImageFilePathIterator() = 0;
-    virtual string get_next() = 0;
-    virtual int counter() const = 0;
-};
-
-typedef boost::shared_ptr<ImageFilePathIterator> ImageFilePathIteratorPtr;
-
-ImageFilePathIterator::~ImageFilePathIterator() {}
-
-
-class StopIteration {};
-
-class RecursiveDirectoryImageFilePathIterator : public ImageFilePathIterator
-{
-    filesystem::recursive_directory_iterator dir_it_;
-    filesystem::recursive_directory_iterator end_;
-    mutable boost::mutex mutex;
-    int i;
-public:
-    RecursiveDirectoryImageFilePathIterator(const string& photos_dir_path) :
-        dir_it_(photos_dir_path), i(0) {}
-
-    virtual string get_next() {
-        boost::mutex::scoped_lock lock(mutex);
-        if (dir_it_ == end_)
-        {
-            throw StopIteration();
-        }
-        string path = dir_it_->path().string();
-        ++dir_it_;
-        ++i;
-        return path;
-    }
-
-    virtual int counter() const {
-        boost::mutex::scoped_lock lock(mutex);
-        return i;
-    }
-};
-
-class InputStreamImageFilePathIterator : public ImageFilePathIterator
-{
-    int i;
-    boost::shared_ptr<std::istream> inputStream_;
-    bool done_;
-    mutable boost::mutex mutex_;
-public:
-    InputStreamImageFilePathIterator(boost::shared_ptr<std::istream> inputStream) : i(0), inputStream_(inputStream), done_(false) {}
-    virtual string get_next() {
-        string result;
-        boost::mutex::scoped_lock lock(mutex_);
-        if(done_)
+        if(input["photos-file"].as<string>() == "-")
         {
-            throw StopIteration();
+            return ImageFilePathIteratorPtr(new InputStreamImageFilePathIterator(boost::shared_ptr<std::istream>(&std::cin, non_deleter)));
         }
-        std::getline(*inputStream_, result);
-        if (result.empty())
+        else
         {
-            done_ = true;
-            throw StopIteration();
+            boost::shared_ptr<std::istream> inputStream(new std::ifstream(input["photos-file"].as<string>().c_str()));
+            return ImageFilePathIteratorPtr(new InputStreamImageFilePathIterator(inputStream));
         }
-        i++;
-        return result;
-    }
-
-    virtual int counter() const {
-        boost::mutex::scoped_lock lock(mutex_);
-        return i;
     }
-};
-
-void add_stones_to_database(MosaicsDatabase* mosaics_database, ImageFilePathIteratorPtr image_file_it, double aspect_ratio, int raster_resolution)
-{
-    while(true)
+    else
     {
-        try
-        {
-            string current_path = image_file_it->get_next();
-            int i = image_file_it->counter();
-            if (iends_with(current_path, ".JPG"))
-            {
-                add_mosaic_stone_to_database(mosaics_database, i, current_path, raster_resolution, raster_resolution, aspect_ratio);
-            }
-            else
-            {
-                cout << i << " " << current_path << " ... "<< "No JPG ==> NOT Added" << std::endl;
-            }
-        }
-        catch (StopIteration&) {
-            break;
-        }
+        throw std::runtime_error("Invalid input type.");
     }
 }
 
-typedef boost::shared_ptr<boost::thread> ThreadPtr;
-typedef list<ThreadPtr> ThreadList;
-
-void build_database(ImageFilePathIteratorPtr image_file_it, const string& output_filename, double aspect_ratio, int raster_resolution, int number_of_threads)
+/// Composites a layout saved by render at the output size given now, without matching again.
+void render_layout(const program_options::variables_map& input)
 {
-    MosaicsDatabase mosaics_database(output_filename, aspect_ratio, raster_resolution);
-
-    ThreadList thread_list;
-    for(int i=0;i<number_of_threads;++i)
+    if(input["time-budget"].as<double>() > 0)
     {
-        thread_list.push_back(ThreadPtr(new boost::thread(add_stones_to_database, &mosaics_database, image_file_it, aspect_ratio, raster_resolution)));
+        throw std::runtime_error("--time-budget cannot be used with render-layout, which does not search.");
     }
-    BOOST_FOREACH(ThreadPtr thread, thread_list)
+    MosaicLayout layout(input["layout-filename"].as<string>());
+    string database_filename = input.count("database-filename") ? database_filename_from_input(input) : layout.database_filename();
+    MosaicsDatabase mosaics_database(database_filename);
+    if(not layout.matches(mosaics_database))
     {
-        thread->join();
+        throw std::runtime_error(database_filename + " has changed since the layout was saved.");
     }
-}
-
+    RenderSettings render_settings(layout.resolution_in_stones(), input["output-width"].as<int>(), layout.min_distance(), mosaics_database.aspect_ratio());
 
-MosaicStonePtr find_closest_match(const list<MosaicStonePtr>& stones, const vector<int>& rastered_piece, const list<MosaicStonePtr>& excluded)
-{
-    int best_deviation = -1;
-    list<MosaicStonePtr>::const_iterator best_stone = stones.end();
-    for(list<MosaicStonePtr>::const_iterator stone = stones.begin(); stone != stones.end(); ++stone)
-    {
-        if (std::find(excluded.begin(), excluded.end(), *stone) == excluded.end())
-        {
-            int deviation = (*stone)->calc_deviation(rastered_piece, best_deviation);
-            if (deviation != -1)
-            {
-                best_deviation = deviation;
-                best_stone = stone;
-            }
-        }
-    }
-    if(best_stone == stones.end())
-    {
-        throw std::runtime_error("Not enough stones for current parameters. Try reducing min-distance.");
-    }
-    return *best_stone;
+    StoneSearcher searcher(mosaics_database, NULL, 0, false);
+    boost::shared_ptr<TileAtlas> atlas = atlas_from_input(input, mosaics_database, database_filename);
+    Renderer renderer(mosaics_database, searcher, input["number-of-threads"].as<int>(), input["prefetch-window"].as<int>(), 0, atlas.get());
+    JPG output_image(render_settings.output_dimensions);
+    // All stones are placed already, so the picture is never looked at.
+    vector<PlacedStone> placed_stones = layout.placed_stones();
+    renderer.render(gil::rgb8_view_t(), output_image, render_settings, input.count("print-time-left"), NULL, &placed_stones);
+    output_image.write(input["output-filename"].as<string>());
+    renderer.statistics().print(cout);
 }
 
-
-class JPG
+void build_database_from_input(const program_options::variables_map& input)
 {
-public:
-    JPG(const Dimensions& dimensions) :
-        image_(dimensions)
+    ImageFilePathIteratorPtr it = createImageFilePathIterator(input);
+    vector<string> aspect_ratios;
+    split(aspect_ratios, input["aspect-ratio"].as<string>(), is_any_of(","));
+    ShardFilter shard_filter(input["shard-index"].as<int>(), input["shard-count"].as<int>());
+    vector<string> database_filenames = build_database(it,
+        input["database-filename"].as<string> (),
+        aspect_ratios, int_list_from_input(input["raster-resolution"].as<string>()), input["number-of-threads"].as<int>(),
+        shard_filter, input.count("resume"));
+    vector<int> atlas_tile_widths = int_list_from_input(input["atlas-tile-widths"].as<string>());
+    BOOST_FOREACH(const string& database_filename, database_filenames)
     {
-       view_ = view(image_);
-    }
-
-    void write(const string& filename)
-    {
-        gil::jpeg_write_view(filename, view_, 85);
-    }
-
-    void set_mosaic_stone(const Position& pos, const Dimensions& stone_size, const string& current_path)
-    {
-        try
+        if(input["index-lists"].as<int>() > 0)
         {
-            double aspect_ratio = (double)stone_size.x/(double)stone_size.y;
-            Orientation orientation = orientation_from_image_path(current_path);
-            gil::point2<std::ptrdiff_t> dimensions = aspect_ratio_cropped_dimensions(current_path, aspect_ratio, orientation);
-            gil::rgb8_image_t mosaic_stone_img_big;
-            gil::jpeg_read_image(current_path, mosaic_stone_img_big);
-
-            gil::rgb8_image_t mosaic_stone_img_small(stone_size.x, stone_size.y);
-
-            Position o;
-
-            switch(orientation)
-            {
-            case NOT_ROTATED:
-                gil::resize_view(gil::subimage_view(const_view(mosaic_stone_img_big), o, dimensions),
-                        view(mosaic_stone_img_small), gil::bilinear_sampler());
-                break;
-            case ROTATED_180:
-                gil::resize_view(gil::subimage_view(rotated180_view(const_view(mosaic_stone_img_big)), o, dimensions),
-                        view(mosaic_stone_img_small), gil::bilinear_sampler());
-                break;
-            case ROTATED_90CCW:
-                gil::resize_view(gil::subimage_view(rotated90cw_view(const_view(mosaic_stone_img_big)), o, dimensions),
-                        view(mosaic_stone_img_small), gil::bilinear_sampler());
-                break;
-            case ROTATED_90CW:
-                gil::resize_view(gil::subimage_view(rotated90ccw_view(const_view(mosaic_stone_img_big)), o, dimensions),
-                        view(mosaic_stone_img_small), gil::bilinear_sampler());
-                break;
-            }
-
-            {
-                boost::mutex::scoped_lock lock(mutex);
-                gil::copy_pixels(const_view(mosaic_stone_img_small), subimage_view(view_, Position(pos.x * stone_size.x, pos.y * stone_size.y), stone_size));
-            }
+            build_index(database_filename, input["index-lists"].as<int>());
         }
-        catch(std::exception& error)
+        if(not atlas_tile_widths.empty())
         {
-            cerr << "Error setting mosaic stone: "<< error.what() << endl;
+            build_atlas(database_filename, atlas_tile_widths, input["number-of-threads"].as<int>());
         }
     }
-
-private:
-    string filename_;
-    gil::rgb8_image_t image_;
-    gil::rgb8_view_t view_;
-    boost::mutex mutex;
-};
-
-class OutputMatrix
-{
-    vector<vector<MosaicStonePtr> > matrix_;
-    mutable boost::mutex mutex;
-
-public:
-    OutputMatrix(const Dimensions& dimensions) : matrix_(dimensions.x, vector<MosaicStonePtr>(dimensions.y))
-    {}
-
-    OutputMatrix(const OutputMatrix& other)
-    {
-        matrix_ = other.matrix_;
-    }
-
-    MosaicStonePtr& operator()(const Position& pos)
-    {
-        return operator()(pos.x, pos.y);
-    }
-
-    const MosaicStonePtr& operator() (const Position& pos) const
-    {
-        return operator()(pos.x, pos.y);
-    }
-
-    MosaicStonePtr& operator()(int x, int y)
-    {
-        boost::mutex::scoped_lock lock(mutex);
-        return matrix_[x][y];
-    }
-
-    const MosaicStonePtr& operator() (int x, int y) const
-    {
-        boost::mutex::scoped_lock lock(mutex);
-        return matrix_[x][y];
-    }
-
-    int xres() const {
-        boost::mutex::scoped_lock lock(mutex);
-        return matrix_.size();
-    }
-
-    int yres() const {
-        boost::mutex::scoped_lock lock(mutex);
-        return matrix_[0].size();
-    }
-};
-
-int start_from_coord_and_min_dinstance(int coord, int min_distance)
-{
-    int result = coord - min_distance;
-    if (result<0)
-    {
-        result = 0;
-    }
-    return result;
 }
 
-int end_from_coord_and_min_distance(int coord, int min_distance, int resolution)
+void build_atlas_from_input(const program_options::variables_map& input)
 {
-    int end = coord+min_distance;
-    if (end > resolution-1)
+    BOOST_FOREACH(const string& database_filename, database_filenames_in(input["database-filename"].as<string> ()))
     {
-        end=resolution-1;
+        build_atlas(database_filename, int_list_from_input(input["atlas-tile-widths"].as<string>()),
+            input["number-of-threads"].as<int>());
     }
-    return end;
 }
 
-list<MosaicStonePtr> create_distance_caused_excludes(const Position& pos, const OutputMatrix& output, int min_distance)
+void build_index_from_input(const program_options::variables_map& input)
 {
-    int startx = start_from_coord_and_min_dinstance(pos.x, min_distance);
-    int starty = start_from_coord_and_min_dinstance(pos.y, min_distance);
-    int endx = end_from_coord_and_min_distance(pos.x, min_distance, output.xres());
-    int endy = end_from_coord_and_min_distance(pos.y, min_distance, output.yres());
-    list<MosaicStonePtr> excludes;
-    for(int i=startx; i<=endx; ++i)
+    BOOST_FOREACH(const string& database_filename, database_filenames_in(input["database-filename"].as<string> ()))
     {
-        for(int j=starty; j<=endy; ++j)
-        {
-            if((i!=pos.x or j!=pos.y) and output(i,j))
-            {
-                excludes.push_back(output(i,j));
-            }
-        }
+        build_index(database_filename, input["index-lists"].as<int>());
     }
-    return excludes;
 }
 
-boost::mutex mosaic_stone_set_mutex;
-
-class Progress
+void merge_database_from_input(const program_options::variables_map& input)
 {
-    int hundred_percent_equivalent_;
-    int done_so_far_;
-    mutable boost::mutex mutex_;
-
-    boost::timer timer_;
-    bool print_time_left_;
-public:
-    Progress(int hundred_percent_equivalent, bool print_time_left = false)
-        : hundred_percent_equivalent_(hundred_percent_equivalent),
-          done_so_far_(0),
-          print_time_left_(print_time_left)
-          {}
-
-    double status() const
-    {
-        return (double)done_so_far_/hundred_percent_equivalent_;
-    }
-
-    void inc_and_print()
-    {
-        if(print_time_left_)
-        {
-            inc_and_print_minutes_left();
-        }
-        else
-        {
-            inc_and_print_status();
-        }
-    }
-
-    void inc_and_print_status()
-    {
-        boost::mutex::scoped_lock lock(mutex_);
-        ++done_so_far_;
-        cout << status() * 100 << "%" << endl;
-    }
-
-    void inc_and_print_minutes_left()
-    {
-        boost::mutex::scoped_lock lock(mutex_);
-        ++done_so_far_;
-        cout << minutes_left() << " minutes left" << endl;
-    }
-
-    double minutes_left() const
-    {
-        return (1.0-status())*timer_.elapsed()/status() / 60;
-    }
-};
-
-struct RenderSettings
-{
-    ptrdiff_t min_distance;
-    Dimensions output_dimensions;
-    Dimensions resolution_in_stones;
-    RenderSettings(const Dimensions& input_dimensions, ptrdiff_t output_width, ptrdiff_t x_resolution_in_stones, ptrdiff_t min_distance_, double aspect_ratio) :
-        min_distance(min_distance_)
-    {
-        resolution_in_stones.x = x_resolution_in_stones;
-        int source_stone_width = input_dimensions.x / resolution_in_stones.x;
-        int source_stone_height = (double)source_stone_width / aspect_ratio;
-        resolution_in_stones.y = input_dimensions.y / source_stone_height;
-
-        output_dimensions.x = output_width;
-        int output_stone_width = output_dimensions.x/resolution_in_stones.x;
-        int output_stone_height = (double)output_stone_width / aspect_ratio;
-        output_dimensions.y = output_stone_height * resolution_in_stones.y;
-    }
-};
-
-template<class SourceView>
-struct RenderParameters
-{
-    int min_distance;
-    Dimensions source_stone_size;
-    Dimensions output_stone_size;
-    SourceView source_view;
-    MosaicsDatabase* mosaics_database;
-    JPG* output_image;
-    OutputMatrix* output;
-    Progress* progress;
-};
-
-
-struct Shuffler
-{
-    virtual ~Shuffler() = 0;
-    virtual void shuffle(vector<Position>& positions) const = 0;
-};
-
-Shuffler::~Shuffler() {}
-
-struct RandomShuffler
-{
-    virtual void shuffle(vector<Position>& positions) const
-    {
-        std::random_shuffle(positions.begin(), positions.end());
-    }
-};
-
-typedef pair<vector<Position>::iterator, vector<Position>::iterator> PositionsRange;
+    merge_database(input["input-database"].as<vector<string> >(),
+        input["output-database-filename"].as<string> ());
+}
 
-template<class SourceView>
-class RenderTask
+void compact_database_from_input(const program_options::variables_map& input)
 {
-public:
-    RenderTask(RenderParameters<SourceView>& render_params) :
-        params(render_params)//, positions_(positions)
-    {}
-
-    void operator()(const PositionsRange& positions)
-    {
-        find_and_set_stones(positions);
-    }
-private:
-
-    void find_and_set_stones(const PositionsRange& positions_)
-    {
-    //    cout << params.row_limits.min << " " << params.row_limits.max << endl;
-        const list<MosaicStonePtr> &stones = params.mosaics_database->stones();
-        OutputMatrix& output_matrix = *params.output;
-
-        for(vector<Position>::iterator pos=positions_.first; pos!=positions_.second; ++pos)
-        {
-            timer.restart();
-            SourceView subimage = subimage_view(params.source_view,
-                    Dimensions(pos->x*params.source_stone_size.x, pos->y*params.source_stone_size.y),
-                    params.source_stone_size);
-
-
-            int raster_resolution = params.mosaics_database->raster_resolution();
-            vector<int> rastered_piece(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS);
-            raster_values_from_view(subimage, raster_resolution, raster_resolution, rastered_piece);
-            timer.print_elapsed_with_label("Elapsed time to create rastered piece");
-
-            MosaicStonePtr mosaic_stone;
-
-            {
-                boost::mutex::scoped_lock lock(mosaic_stone_set_mutex);
-
-                timer.restart();
-                list<MosaicStonePtr> excluded_stones = create_distance_caused_excludes(*pos, output_matrix, params.min_distance);
-                timer.print_elapsed_with_label("Elapsed time to find excludes");
-
-                timer.restart();
-                mosaic_stone = find_closest_match(stones, rastered_piece, excluded_stones);
-                timer.print_elapsed_with_label("Elapsed time to find stone");
-
-                output_matrix(*pos) = mosaic_stone;
-            }
-
-            params.output_image->set_mosaic_stone(*pos, params.output_stone_size, mosaic_stone->image_file_path());
-    //            progress->inc_and_print_status();
-            params.progress->inc_and_print();
-        }
-
-    }
-
-    RenderParameters<SourceView> params;
-//    PositionsRange positions_;
-};
+    compact_database(input["database-filename"].as<string> (),
+        input["output-database-filename"].as<string> (),
+        input["duplicate-threshold"].as<int>(),
+        input.count("confirm-with-perceptual-hash"),
+        input["max-perceptual-hash-distance"].as<int>());
+}
 
-class Renderer
+/// Renders the picture on this machine.
+void render_picture(const program_options::variables_map& input)
 {
-
-public:
-    Renderer(MosaicsDatabase& mosaics_database, int number_of_threads) :
-        number_of_threads_(number_of_threads), mosaics_database_(mosaics_database) {}
-
-    template<class SourceView>
-    OutputMatrix render(const SourceView& source_view, JPG& output_image, const RenderSettings& render_settings, bool print_time_left)
+    boost::shared_ptr<TimeBudget> time_budget;
+    if(input["time-budget"].as<double>() > 0)
     {
-        int source_stone_width = source_view.width() / render_settings.resolution_in_stones.x;
-        int source_stone_height = source_stone_width / mosaics_database_.aspect_ratio();
-        int output_stone_width = render_settings.output_dimensions.x / render_settings.resolution_in_stones.x;
-        int output_stone_height = (double)output_stone_width / mosaics_database_.aspect_ratio();
-
-        OutputMatrix output(render_settings.resolution_in_stones);
-
-        int number_of_stones = render_settings.resolution_in_stones.y * render_settings.resolution_in_stones.x;
-        vector<Position> positions(number_of_stones);
-
-        if(static_cast<size_t>(render_settings.min_distance *render_settings.min_distance) > mosaics_database_.stones().size())
-        {
-            throw std::runtime_error("Not enough stones for current settings. Either use a bigger database or reduce min-distance.");
-        }
-
-        for(int i=0;i<render_settings.resolution_in_stones.y;++i)
-        {
-            for(int j=0;j<render_settings.resolution_in_stones.x;++j)
-            {
-                Position position; position.x = j; position.y = i;
-                positions[i*render_settings.resolution_in_stones.x+j] = position;
-            }
-        }
-        std::random_shuffle(positions.begin(), positions.end());
-        if(number_of_threads_ > number_of_stones)
-        {
-            throw std::runtime_error("Cannot use more threads than mosaic stones.");
-        }
-        int stones_per_thread = number_of_stones / number_of_threads_;
-
-        Progress progress(number_of_stones, print_time_left);
-
-        ThreadList thread_list;
-        RenderParameters<SourceView> render_parameters;
-        render_parameters.min_distance = render_settings.min_distance;
-        render_parameters.source_stone_size = Dimensions(source_stone_width, source_stone_height);
-        render_parameters.output_stone_size = Dimensions(output_stone_width, output_stone_height);
-        render_parameters.mosaics_database = &mosaics_database_;
-        render_parameters.output = &output;
-        render_parameters.output_image = &output_image;
-        render_parameters.progress = &progress;
-        render_parameters.source_view = source_view;
-        ;RenderTask<SourceView> render_task(render_parameters);
-        for(int i=0; i<number_of_threads_-1;++i)
-        {
-            thread_list.push_back(ThreadPtr(new boost::thread(render_task,
-                    PositionsRange(positions.begin() + i*stones_per_thread, positions.begin() + i*stones_per_thread+stones_per_thread))));
-        }
-        thread_list.push_back(ThreadPtr(new boost::thread(render_task,
-                PositionsRange(positions.begin()+(number_of_threads_-1)*stones_per_thread,
-                        positions.begin()+number_of_stones))));
-
-        BOOST_FOREACH(ThreadPtr thread, thread_list)
-        {
-            thread->join();
-        }
-        return output;
+        time_budget.reset(new TimeBudget(input["time-budget"].as<double>()));
     }
-private:
-    int number_of_threads_;
-    MosaicsDatabase& mosaics_database_;
-};
+    string source_img_path = input["picture-path"].as<string>();
+    Orientation orientation = orientation_from_image_path(source_img_path);
 
-double aspect_ratio_from_input(const string& input)
-{
-    double aspect_ratio;
-    if (input.find('x') == string::npos)
-    {
-        aspect_ratio = lexical_cast<double>(input);
-    }
-    else
-    {
-        vector<string> dimensions_string;
-        split(dimensions_string, input, is_any_of("x"));
-        aspect_ratio = lexical_cast<double>(dimensions_string[0])/lexical_cast<double>(dimensions_string[1]);
-    }
-    return aspect_ratio;
-}
+    gil::rgb8_image_t source_image;
+    gil::jpeg_read_and_convert_image(source_img_path, source_image);
+    gil::rgb8_view_t source_view = view(source_image);
 
-void non_deleter(std::istream* p) {}
+    string database_filename = database_filename_from_input(input);
+    MosaicsDatabase mosaics_database(database_filename);
 
-ImageFilePathIteratorPtr createImageFilePathIterator(const program_options::variables_map& input)
-{
-    if(input["input-type"].as<string>() == "directory")
+    boost::shared_ptr<InvertedFileIndex> index;
+    if(input["search-probes"].as<int>() > 0)
     {
-        return ImageFilePathIteratorPtr(new RecursiveDirectoryImageFilePathIterator(input["photos-dir"].as<string> ()));
+        index.reset(new InvertedFileIndex(index_filename_from_database_filename(database_filename), mosaics_database));
     }
-    else if (input["input-type"].as<string>() == "file")
-    {
-        if(input["photos-file"].as<string>() == "-")
-        {
-            return ImageFilePathIteratorPtr(new InputStreamImageFilePathIterator(boost::shared_ptr<std::istream>(&std::cin, non_deleter)));
-        }
-        else
-        {
-            boost::shared_ptr<std::istream> inputStream(new std::ifstream(input["photos-file"].as<string>().c_str()));
-            return ImageFilePathIteratorPtr(new InputStreamImageFilePathIterator(inputStream));
-        }
-    }
-    else
-    {
-        throw std::runtime_error("Invalid input type.");
-    }
-}
+    StoneSearcher searcher(mosaics_database, index.get(), input["search-probes"].as<int>(), input.count("benchmark-recall"));
 
-string help()
-{
-    std::stringstream output;
-    output << "USAGE: " << endl
-        << "phomo build-database <build-databse-options>" << endl
-        << "phomo render <render-options>" << endl
-        << "phomo -h | -v\n\n"
-     << visible_options_description();
-    return output.str();
-}
+    boost::shared_ptr<TileAtlas> atlas = atlas_from_input(input, mosaics_database, database_filename);
+    Renderer renderer(mosaics_database, searcher, input["number-of-threads"].as<int>(), input["prefetch-window"].as<int>(),
+            input["candidates-per-tile"].as<int>(), atlas.get(), time_budget.get());
+    RenderSettings renderSettings(
+            swap_dimensions_if(source_view.dimensions(), orientation),
+            input["output-width"].as<int>(),
+            input["x-resolution-in-stones"].as<int>(),
+            input["min-distance"].as<int>(),
+            mosaics_database.aspect_ratio());
 
-string version()
-{
-    return "phomo " VERSION;
-}
-
-Dimensions swap_dimensions_if(const Dimensions& dimensions, Orientation orientation)
-{
-    if (orientation == NOT_ROTATED || orientation == ROTATED_180)
+    boost::shared_ptr<RenderCheckpoint> checkpoint;
+    boost::shared_ptr<JPG> output_image;
+    if(input["checkpoint-interval"].as<int>() > 0 or input.count("resume"))
     {
-        return dimensions;
+        std::stringstream fingerprint;
+        fingerprint << source_img_path << "|" << database_filename << "|" << mosaics_database.stones().size()
+                    << "|" << mosaics_database.checksum()
+                    << "|" << renderSettings.output_dimensions.x << "x" << renderSettings.output_dimensions.y
+                    << "|" << renderSettings.resolution_in_stones.x << "x" << renderSettings.resolution_in_stones.y
+                    << "|" << renderSettings.min_distance;
+        checkpoint.reset(new RenderCheckpoint(input["output-filename"].as<string>(), fingerprint.str(),
+                renderSettings.output_dimensions, input["checkpoint-interval"].as<int>(), input.count("resume")));
+        output_image.reset(new JPG(renderSettings.output_dimensions, checkpoint->image_filename(), checkpoint->resumed()));
     }
     else
     {
-        return Dimensions(dimensions.y, dimensions.x);
+        output_image.reset(new JPG(renderSettings.output_dimensions));
     }
-}
-
-int main(int argc, char** argv)
-{
-    program_options::variables_map input = parse_command_line(argc, argv);
 
-    if(input.count("help"))
+    OutputMatrix output = render_oriented(renderer, source_view, orientation, *output_image, renderSettings,
+            input.count("print-time-left"), checkpoint.get());
+    output_image->write(input["output-filename"].as<string>());
+    if(input.count("layout-filename"))
     {
-        cout << help() << endl;
+        MosaicLayout(output, database_filename, mosaics_database, renderSettings.min_distance)
+            .write(input["layout-filename"].as<string>());
     }
-    else if (input.count("version"))
+    if(checkpoint)
     {
-        cout << version() << endl;
+        checkpoint->remove();
     }
-    else if (input.count("action"))
+    renderer.statistics().print(cout);
+    searcher.print_statistics(cout);
+    if(time_budget)
     {
-        if (input["action"].as<string> () == "build-database")
+        time_budget->print_report(cout);
+        if(input.count("degraded-tiles-filename"))
         {
-            ImageFilePathIteratorPtr it = createImageFilePathIterator(input);
-            double aspect_ratio = aspect_ratio_from_input(input["aspect-ratio"].as<string>());
-            build_database(it,
-                input["database-filename"].as<string> (),
-                aspect_ratio, input["raster-resolution"].as<int>(), input["number-of-threads"].as<int>());
+            time_budget->write_degraded_tiles(input["degraded-tiles-filename"].as<string>());
         }
-        else if (input["action"].as<string> () == "render")
-        {
-            string source_img_path = input["picture-path"].as<string>();
-            Orientation orientation = orientation_from_image_path(source_img_path);
-
-            gil::rgb8_image_t source_image;
-            gil::jpeg_read_and_convert_image(source_img_path, source_image);
-            gil::rgb8_view_t source_view = view(source_image);
-
-            MosaicsDatabase mosaics_database(input["database-filename"].as<string> ());
-
-            Renderer renderer(mosaics_database, input["number-of-threads"].as<int>());
-            RenderSettings renderSettings(
-                    swap_dimensions_if(source_view.dimensions(), orientation),
-                    input["output-width"].as<int>(),
-                    input["x-resolution-in-stones"].as<int>(),
-                    input["min-distance"].as<int>(),
-                    mosaics_database.aspect_ratio());
-
-            JPG output_image(renderSettings.output_dimensions);
-
-            switch(orientation)
-            {
-            case NOT_ROTATED:
-                renderer.render(source_view,
-                    output_image, renderSettings,
-                    input.count("print-time-left"));
-                break;
-            case ROTATED_180:
-                renderer.render(gil::rotated180_view(source_view),
-                    output_image, renderSettings,
-                    input.count("print-time-left"));
-                break;
-            case ROTATED_90CCW:
-                renderer.render(gil::rotated90cw_view(source_view),
-                    output_image, renderSettings,
-                    input.count("print-time-left"));
-                break;
-            case ROTATED_90CW:
-                renderer.render(gil::rotated90ccw_view(source_view),
-                    output_image, renderSettings,
-                    input.count("print-time-left"));
-                break;
-            }
-            output_image.write(input["output-filename"].as<string>());
-        }
-        else
-        {
-            cerr << "No action was specified." << endl;
-            cout << help() << endl;
-        }
-    }
-    else
-    {
-        cerr << "No action was specified." << endl;
-        cout << help() << endl;
     }
-    return 0;
 }
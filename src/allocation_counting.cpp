@@ -0,0 +1,48 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Replaces operator new to count the allocations of every thread, to find the ones in
+ * the render loop. Only the command line links this in, so that libphomo never
+ * replaces the operator new of the program it is loaded into.
+ */
+
+#ifdef PHOMO_COUNT_ALLOCATIONS
+
+#include "phomo_actions.h"
+
+#include <cstdlib>
+#include <new>
+
+void* operator new(size_t size)
+{
+    ++thread_allocation_count;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if(memory == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) throw()
+{
+    free(memory);
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "atlas.h"
+
+string atlas_filename_from_database_filename(const string& database_filename)
+{
+    return database_filename + ".atlas";
+}
+
+/// Each level is scaled down from the next bigger one, which looks better and is faster than scaling the original every time.
+template<class View>
+void write_atlas_tiles(const View& oriented_view, const Dimensions& cropped_dimensions, const vector<gil::rgb8_view_t>& tiles)
+{
+    gil::resize_view(gil::subimage_view(oriented_view, Position(0, 0), cropped_dimensions), tiles[0], gil::bilinear_sampler());
+    for(size_t level=1; level<tiles.size(); ++level)
+    {
+        gil::resize_view(gil::rgb8c_view_t(tiles[level - 1]), tiles[level], gil::bilinear_sampler());
+    }
+}
+
+void add_stones_to_atlas(const vector<MosaicStonePtr>* stones, boost::atomic<size_t>* next_stone, const AtlasLayout* layout,
+        char* data, double aspect_ratio)
+{
+    // Levels from the biggest to the smallest tiles.
+    vector<pair<ptrdiff_t, int> > levels_by_size;
+    for(size_t level=0; level<layout->levels.size(); ++level)
+    {
+        levels_by_size.push_back(pair<ptrdiff_t, int>(-layout->levels[level].x, level));
+    }
+    std::sort(levels_by_size.begin(), levels_by_size.end());
+
+    for(size_t i = (*next_stone)++; i < stones->size(); i = (*next_stone)++)
+    {
+        const MosaicStone& stone = *(*stones)[i];
+        vector<gil::rgb8_view_t> tiles;
+        for(size_t j=0; j<levels_by_size.size(); ++j)
+        {
+            int level = levels_by_size[j].second;
+            tiles.push_back(gil::interleaved_view(layout->levels[level].x, layout->levels[level].y,
+                    reinterpret_cast<gil::rgb8_pixel_t*>(data + layout->tile_offset(level, stone.id())),
+                    layout->levels[level].x * NUMBER_OF_CHANNELS));
+        }
+        try
+        {
+            Orientation orientation = orientation_from_image_path(stone.image_file_path());
+            Dimensions dimensions = aspect_ratio_cropped_dimensions(stone.image_file_path(), aspect_ratio, orientation);
+            gil::rgb8_image_t source_image;
+            gil::jpeg_read_and_convert_image(stone.image_file_path(), source_image);
+            switch(orientation)
+            {
+            case NOT_ROTATED:
+                write_atlas_tiles(const_view(source_image), dimensions, tiles);
+                break;
+            case ROTATED_180:
+                write_atlas_tiles(rotated180_view(const_view(source_image)), dimensions, tiles);
+                break;
+            case ROTATED_90CCW:
+                write_atlas_tiles(rotated90cw_view(const_view(source_image)), dimensions, tiles);
+                break;
+            case ROTATED_90CW:
+                write_atlas_tiles(rotated90ccw_view(const_view(source_image)), dimensions, tiles);
+                break;
+            }
+            data[layout->flags_offset + stone.id() - 1] = 1;
+        }
+        catch(std::exception& error)
+        {
+            cerr << "Cannot add " << stone.image_file_path() << " to tile atlas: " << error.what() << " ==> skipping" << endl;
+        }
+    }
+}
+
+void build_atlas(const string& database_filename, const vector<int>& tile_widths, int number_of_threads)
+{
+    if(tile_widths.empty())
+    {
+        throw std::runtime_error("build-atlas needs --atlas-tile-widths.");
+    }
+    MosaicsDatabase mosaics_database(database_filename);
+    vector<Dimensions> levels;
+    BOOST_FOREACH(int tile_width, tile_widths)
+    {
+        if(tile_width < 1)
+        {
+            throw std::runtime_error("Atlas tile widths must be positive.");
+        }
+        levels.push_back(Dimensions(tile_width, std::max(1, (int)(tile_width / mosaics_database.aspect_ratio()))));
+    }
+    AtlasLayout layout(levels, mosaics_database.stones().size());
+
+    string atlas_filename = atlas_filename_from_database_filename(database_filename);
+    int fd = open(atlas_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1 or ftruncate(fd, layout.size) != 0)
+    {
+        throw std::runtime_error("Cannot create " + atlas_filename + ": " + strerror(errno));
+    }
+    void* mapping = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map " + atlas_filename + ": " + strerror(errno));
+    }
+    char* data = static_cast<char*>(mapping);
+
+    AtlasHeader header;
+    memcpy(header.magic, ATLAS_MAGIC, sizeof(ATLAS_MAGIC));
+    header.version = ATLAS_VERSION;
+    header.stone_count = layout.stone_count;
+    header.level_count = levels.size();
+    header.reserved = 0;
+    header.database_checksum = mosaics_database.checksum();
+    memcpy(data, &header, sizeof(header));
+    boost::uint32_t* level_sizes = reinterpret_cast<boost::uint32_t*>(data + sizeof(AtlasHeader));
+    for(size_t i=0; i<levels.size(); ++i)
+    {
+        level_sizes[2*i] = levels[i].x;
+        level_sizes[2*i + 1] = levels[i].y;
+    }
+
+    vector<MosaicStonePtr> stones(mosaics_database.stones().begin(), mosaics_database.stones().end());
+    boost::atomic<size_t> next_stone(0);
+    ThreadList thread_list;
+    for(int i=0; i<number_of_threads; ++i)
+    {
+        thread_list.push_back(ThreadPtr(new boost::thread(add_stones_to_atlas, &stones, &next_stone, &layout, data, mosaics_database.aspect_ratio())));
+    }
+    BOOST_FOREACH(ThreadPtr thread, thread_list)
+    {
+        thread->join();
+    }
+    munmap(mapping, layout.size);
+    cout << "Built tile atlas with " << levels.size() << " levels for " << stones.size() << " stones." << endl;
+}
+
+boost::shared_ptr<TileAtlas> open_atlas(const MosaicsDatabase& mosaics_database, const string& database_filename)
+{
+    boost::shared_ptr<TileAtlas> atlas;
+    string atlas_filename = atlas_filename_from_database_filename(database_filename);
+    if(filesystem::exists(atlas_filename))
+    {
+        atlas.reset(new TileAtlas(atlas_filename, mosaics_database));
+    }
+    return atlas;
+}
+
+boost::shared_ptr<TileAtlas> atlas_from_input(const program_options::variables_map& input, const MosaicsDatabase& mosaics_database,
+        const string& database_filename)
+{
+    if(input.count("ignore-atlas"))
+    {
+        return boost::shared_ptr<TileAtlas>();
+    }
+    try
+    {
+        return open_atlas(mosaics_database, database_filename);
+    }
+    catch(std::exception& error)
+    {
+        cerr << error.what() << " ==> using the original photos" << endl;
+        return boost::shared_ptr<TileAtlas>();
+    }
+}
@@ -0,0 +1,216 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * The tile atlas next to a database, which holds every stone scaled down to a few
+ * widths, so that render does not decode the stone photos.
+ */
+#ifndef PHOMO_ATLAS_H
+#define PHOMO_ATLAS_H
+
+#include "database.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+string atlas_filename_from_database_filename(const string& database_filename);
+
+const char ATLAS_MAGIC[8] = {'P', 'H', 'O', 'M', 'O', 'A', 'T', 'L'};
+const boost::uint32_t ATLAS_VERSION = 2;
+
+struct AtlasHeader
+{
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t stone_count;
+    boost::uint32_t level_count;
+    boost::uint32_t reserved;
+    boost::uint64_t database_checksum;
+};
+
+/**
+ * Layout of an atlas file: the header, the width and height of every level, one byte
+ * per stone telling whether its photo could be read, and then, page aligned, one block
+ * of tiles per level. Tiles are raw RGB pixels stored in order of stone ids, so that
+ * the tiles of the level a render uses lie next to each other.
+ */
+struct AtlasLayout
+{
+    vector<Dimensions> levels;
+    size_t stone_count;
+    size_t flags_offset;
+    vector<size_t> level_offsets;
+    size_t size;
+
+    AtlasLayout(const vector<Dimensions>& levels_, size_t stone_count_) :
+        levels(levels_), stone_count(stone_count_)
+    {
+        flags_offset = sizeof(AtlasHeader) + levels.size() * 2 * sizeof(boost::uint32_t);
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size = (flags_offset + stone_count + page_size - 1) / page_size * page_size;
+        BOOST_FOREACH(const Dimensions& level, levels)
+        {
+            level_offsets.push_back(size);
+            size += stone_count * level.x * level.y * NUMBER_OF_CHANNELS;
+        }
+    }
+
+    size_t tile_offset(int level, int stone_id) const
+    {
+        return level_offsets[level] + (stone_id - 1) * levels[level].x * levels[level].y * NUMBER_OF_CHANNELS;
+    }
+};
+
+/**
+ * Pre-rendered tiles of all stones of a database, already oriented, cropped to the
+ * aspect ratio of the database and scaled down to a few fixed sizes. A render takes
+ * its stones from here instead of decoding the original photos.
+ */
+class TileAtlas
+{
+public:
+    TileAtlas(const string& atlas_filename, const MosaicsDatabase& database) :
+        data_(NULL), size_(0)
+    {
+        int fd = open(atlas_filename.c_str(), O_RDONLY);
+        struct stat status;
+        if(fd == -1 or fstat(fd, &status) != 0)
+        {
+            throw std::runtime_error("Cannot open tile atlas " + atlas_filename + ".");
+        }
+        size_ = status.st_size;
+        void* data = size_ < sizeof(AtlasHeader) ? MAP_FAILED : mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map tile atlas " + atlas_filename + ".");
+        }
+        data_ = static_cast<const char*>(data);
+        try
+        {
+            read_layout(atlas_filename, database);
+        }
+        catch(...)
+        {
+            munmap(data, size_);
+            throw;
+        }
+    }
+
+    ~TileAtlas()
+    {
+        munmap(const_cast<char*>(data_), size_);
+    }
+
+    /// The smallest level whose tiles are at least stone_size, or -1 if all are smaller.
+    int level_for(const Dimensions& stone_size) const
+    {
+        int best_level = -1;
+        for(size_t level=0; level<layout_->levels.size(); ++level)
+        {
+            const Dimensions& tile_size = layout_->levels[level];
+            if(tile_size.x >= stone_size.x and tile_size.y >= stone_size.y and
+                    (best_level == -1 or tile_size.x < layout_->levels[best_level].x))
+            {
+                best_level = level;
+            }
+        }
+        return best_level;
+    }
+
+    /// The level with the biggest tiles, or -1 if the atlas has no levels.
+    int biggest_level() const
+    {
+        int best_level = -1;
+        for(size_t level=0; level<layout_->levels.size(); ++level)
+        {
+            if(best_level == -1 or layout_->levels[level].x > layout_->levels[best_level].x)
+            {
+                best_level = level;
+            }
+        }
+        return best_level;
+    }
+
+    const Dimensions& tile_size(int level) const { return layout_->levels[level]; }
+
+    bool has_tile(int stone_id) const
+    {
+        return data_[layout_->flags_offset + stone_id - 1] != 0;
+    }
+
+    gil::rgb8c_view_t tile(int level, int stone_id) const
+    {
+        const Dimensions& size = layout_->levels[level];
+        return gil::interleaved_view(size.x, size.y,
+                reinterpret_cast<const gil::rgb8_pixel_t*>(data_ + layout_->tile_offset(level, stone_id)), size.x * NUMBER_OF_CHANNELS);
+    }
+
+    /// Like prefetch_file(), but for a single tile.
+    void prefetch(int level, int stone_id) const
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t begin = layout_->tile_offset(level, stone_id) / page_size * page_size;
+        size_t end = layout_->tile_offset(level, stone_id) + tile_size(level).x * tile_size(level).y * NUMBER_OF_CHANNELS;
+        madvise(const_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+    }
+
+private:
+    void read_layout(const string& atlas_filename, const MosaicsDatabase& database)
+    {
+        const AtlasHeader* header = reinterpret_cast<const AtlasHeader*>(data_);
+        if(memcmp(header->magic, ATLAS_MAGIC, sizeof(ATLAS_MAGIC)) != 0 or header->version != ATLAS_VERSION)
+        {
+            throw std::runtime_error(atlas_filename + " is not a tile atlas of this version of phomo.");
+        }
+        if(header->stone_count != database.stones().size() or header->database_checksum != database.checksum())
+        {
+            throw std::runtime_error("Tile atlas " + atlas_filename + " does not belong to the database. Rebuild it with build-atlas.");
+        }
+        if(header->level_count > (size_ - sizeof(AtlasHeader)) / (2 * sizeof(boost::uint32_t)))
+        {
+            throw std::runtime_error("Tile atlas " + atlas_filename + " is truncated.");
+        }
+        const boost::uint32_t* level_sizes = reinterpret_cast<const boost::uint32_t*>(data_ + sizeof(AtlasHeader));
+        vector<Dimensions> levels;
+        for(size_t i=0; i<header->level_count; ++i)
+        {
+            levels.push_back(Dimensions(level_sizes[2*i], level_sizes[2*i + 1]));
+        }
+        layout_.reset(new AtlasLayout(levels, header->stone_count));
+        if(layout_->size != size_)
+        {
+            throw std::runtime_error("Tile atlas " + atlas_filename + " is truncated.");
+        }
+    }
+
+    const char* data_;
+    size_t size_;
+    boost::shared_ptr<AtlasLayout> layout_;
+};
+
+void build_atlas(const string& database_filename, const vector<int>& tile_widths, int number_of_threads);
+
+/// The tile atlas next to the database, or none if there is none. Throws if it is out of date.
+boost::shared_ptr<TileAtlas> open_atlas(const MosaicsDatabase& mosaics_database, const string& database_filename);
+
+/// The atlas next to the database, if there is one and it may be used.
+boost::shared_ptr<TileAtlas> atlas_from_input(const program_options::variables_map& input, const MosaicsDatabase& mosaics_database,
+        const string& database_filename);
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * The C interface of libphomo, which phomo.h declares. Errors never leave it as
+ * exceptions, they are kept for phomo_last_error().
+ */
+
+#include "phomo.h"
+#include "render.h"
+
+static __thread char last_error[1024];
+
+static void set_last_error(const char* message)
+{
+    strncpy(last_error, message, sizeof(last_error) - 1);
+    last_error[sizeof(last_error) - 1] = '\0';
+}
+
+/**
+ * What a database handle of the C interface keeps between renders: the stones, the
+ * searcher with the stones sorted by brightness, and the index and the tile atlas
+ * next to them, if there are any.
+ */
+struct phomo_database
+{
+    explicit phomo_database(const string& filename) :
+        database(filename, false)
+    {
+        string index_filename = index_filename_from_database_filename(filename);
+        if(filesystem::exists(index_filename))
+        {
+            try
+            {
+                index.reset(new InvertedFileIndex(index_filename, database));
+            }
+            catch(std::exception&)
+            {
+                // Renders that ask for search probes fail, all others search the whole database.
+            }
+        }
+        try
+        {
+            atlas = open_atlas(database, filename);
+        }
+        catch(std::exception&)
+        {
+            // Stones are taken from the original photos.
+        }
+        searcher.reset(new StoneSearcher(database, index.get(), 0, false));
+    }
+
+    MosaicsDatabase database;
+    boost::shared_ptr<InvertedFileIndex> index;
+    boost::shared_ptr<TileAtlas> atlas;
+    /// Searches the whole database, renders with search probes derive their own searcher from it.
+    boost::shared_ptr<StoneSearcher> searcher;
+};
+
+/// Throws unless every field of settings is in its range, the picture size is checked by RenderSettings.
+void check_render_settings(const phomo_database* database, const phomo_render_settings* settings)
+{
+    if(database == NULL or settings == NULL)
+    {
+        throw std::runtime_error("No database or no render settings were given.");
+    }
+    if(settings->x_resolution_in_stones < 1 or settings->output_width < 1 or settings->number_of_threads < 1)
+    {
+        throw std::runtime_error("x_resolution_in_stones, output_width and number_of_threads must be at least 1.");
+    }
+    if(settings->min_distance < 0 or settings->prefetch_window < 0 or settings->search_probes < 0 or settings->candidates_per_tile < 0
+            or not (settings->time_budget >= 0))
+    {
+        throw std::runtime_error("min_distance, prefetch_window, search_probes, candidates_per_tile and time_budget must not be negative.");
+    }
+}
+
+void phomo_default_render_settings(phomo_render_settings* settings)
+{
+    settings->x_resolution_in_stones = 10;
+    settings->output_width = 1024;
+    settings->min_distance = 10;
+    settings->number_of_threads = 4;
+    settings->prefetch_window = 16;
+    settings->search_probes = 0;
+    settings->candidates_per_tile = 0;
+    settings->use_atlas = 1;
+    settings->time_budget = 0;
+}
+
+phomo_database* phomo_open_database(const char* filename)
+{
+    try
+    {
+        if(filename == NULL)
+        {
+            throw std::runtime_error("No database filename was given.");
+        }
+        return new phomo_database(filename);
+    }
+    catch(std::exception& error)
+    {
+        set_last_error(error.what());
+        return NULL;
+    }
+    catch(...)
+    {
+        set_last_error("Unknown error.");
+        return NULL;
+    }
+}
+
+void phomo_close_database(phomo_database* database)
+{
+    delete database;
+}
+
+int phomo_output_dimensions(const phomo_database* database, const phomo_render_settings* settings,
+        int picture_width, int picture_height, int* output_width, int* output_height)
+{
+    try
+    {
+        check_render_settings(database, settings);
+        if(output_width == NULL or output_height == NULL)
+        {
+            throw std::runtime_error("No output size was asked for.");
+        }
+        RenderSettings render_settings(Dimensions(picture_width, picture_height), settings->output_width, settings->x_resolution_in_stones,
+                settings->min_distance, database->database.aspect_ratio());
+        *output_width = render_settings.output_dimensions.x;
+        *output_height = render_settings.output_dimensions.y;
+        return PHOMO_OK;
+    }
+    catch(std::exception& error)
+    {
+        set_last_error(error.what());
+        return PHOMO_ERROR;
+    }
+    catch(...)
+    {
+        set_last_error("Unknown error.");
+        return PHOMO_ERROR;
+    }
+}
+
+int phomo_render(phomo_database* database, const phomo_render_settings* settings,
+        const unsigned char* picture, int picture_width, int picture_height, int picture_stride,
+        unsigned char* output, int output_stride, phomo_progress_callback progress, void* user_data)
+{
+    try
+    {
+        check_render_settings(database, settings);
+        if(picture == NULL or output == NULL or picture_stride < 3 * picture_width)
+        {
+            throw std::runtime_error("No picture or no output was given, or the picture stride is too small.");
+        }
+        boost::shared_ptr<TimeBudget> time_budget;
+        if(settings->time_budget > 0)
+        {
+            time_budget.reset(new TimeBudget(settings->time_budget));
+        }
+        if(settings->search_probes > 0 and not database->index)
+        {
+            throw std::runtime_error("The database has no index. Create it with build-index.");
+        }
+        RenderSettings render_settings(Dimensions(picture_width, picture_height), settings->output_width, settings->x_resolution_in_stones,
+                settings->min_distance, database->database.aspect_ratio());
+        if(output_stride < 3 * render_settings.output_dimensions.x)
+        {
+            throw std::runtime_error("The output stride is too small.");
+        }
+        JPG output_image(gil::interleaved_view(render_settings.output_dimensions.x, render_settings.output_dimensions.y,
+                reinterpret_cast<gil::rgb8_pixel_t*>(output), output_stride));
+        StoneSearcher* searcher = database->searcher.get();
+        boost::shared_ptr<StoneSearcher> probing_searcher;
+        if(settings->search_probes > 0)
+        {
+            probing_searcher.reset(new StoneSearcher(*searcher, settings->search_probes));
+            searcher = probing_searcher.get();
+        }
+        Renderer renderer(database->database, *searcher, settings->number_of_threads, settings->prefetch_window, settings->candidates_per_tile,
+                settings->use_atlas ? database->atlas.get() : NULL, time_budget.get());
+        renderer.report_progress_to(progress, user_data);
+        renderer.render(gil::interleaved_view(picture_width, picture_height, reinterpret_cast<const gil::rgb8_pixel_t*>(picture), picture_stride),
+                output_image, render_settings, false);
+        return renderer.cancelled() ? PHOMO_CANCELLED : PHOMO_OK;
+    }
+    catch(std::exception& error)
+    {
+        set_last_error(error.what());
+        return PHOMO_ERROR;
+    }
+    catch(...)
+    {
+        set_last_error("Unknown error.");
+        return PHOMO_ERROR;
+    }
+}
+
+const char* phomo_last_error(void)
+{
+    return last_error;
+}
@@ -0,0 +1,477 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "database.h"
+
+double aspect_ratio_from_input(const string& input)
+{
+    double aspect_ratio;
+    if (input.find('x') == string::npos)
+    {
+        aspect_ratio = lexical_cast<double>(input);
+    }
+    else
+    {
+        vector<string> dimensions_string;
+        split(dimensions_string, input, is_any_of("x"));
+        aspect_ratio = lexical_cast<double>(dimensions_string[0])/lexical_cast<double>(dimensions_string[1]);
+    }
+    return aspect_ratio;
+}
+
+void move_into_place(const string& temporary_filename, const string& filename)
+{
+    if(rename(temporary_filename.c_str(), filename.c_str()) != 0)
+    {
+        throw std::runtime_error("Cannot replace " + filename + ": " + strerror(errno));
+    }
+}
+
+/// Decodes the photo once for all variants that do not contain it yet.
+void add_mosaic_stone_to_databases(const vector<DatabaseVariantPtr>& variants, int i, const string& current_path)
+{
+    std::stringstream output;
+    output << i << "(thread-id: " <<  boost::this_thread::get_id() << ") "<< " " << current_path << " ... ";
+    try
+    {
+        FileStamp stamp;
+        if(not read_file_stamp(current_path, stamp))
+        {
+            throw std::runtime_error(string("Cannot stat photo: ") + strerror(errno));
+        }
+        Orientation orientation = orientation_from_image_path(current_path);
+        gil::rgb8_image_t source_image;
+        gil::jpeg_read_and_convert_image(current_path, source_image);
+        // All stones are created before any is added, so that a photo that fails is in none of the databases.
+        vector<pair<DatabaseVariantPtr, MosaicStonePtr> > stones;
+        BOOST_FOREACH(DatabaseVariantPtr variant, variants)
+        {
+            if(not variant->already_indexed(current_path))
+            {
+                stones.push_back(pair<DatabaseVariantPtr, MosaicStonePtr>(variant, variant->create_mosaic_stone(current_path, const_view(source_image), orientation, stamp)));
+            }
+        }
+        for(size_t j=0; j<stones.size(); ++j)
+        {
+            stones[j].first->add_mosaic_stone(stones[j].second);
+        }
+        output << "Added" << std::endl;
+        cout << output.str();
+    }
+    catch(std::exception& error)
+    {
+        output << "Error: " << error.what() << " ==> skipping" << std::endl;
+        cerr << output.str();
+    }
+    catch(...)
+    {
+        output << "Unknown error ==> skipping" << std::endl;
+        cerr << output.str();
+    }
+}
+
+const string DATABASE_VARIANTS_HEADER = "variants";
+
+/**
+ * A manifest of database variants has a "variants" line followed by one
+ * "aspect-ratio|raster-resolution|filename" line per variant, with filenames relative
+ * to the manifest. Returns no variants if filename is a database itself.
+ */
+vector<pair<pair<double, int>, string> > read_database_variants(const string& filename)
+{
+    vector<pair<pair<double, int>, string> > variants;
+    ifstream file(filename.c_str());
+    string line;
+    if(not std::getline(file, line) or line != DATABASE_VARIANTS_HEADER)
+    {
+        return variants;
+    }
+    filesystem::path directory = filesystem::path(filename).parent_path();
+    while(std::getline(file, line))
+    {
+        vector<string> parts;
+        split(parts, line, is_any_of("|"));
+        if(parts.size() != 3)
+        {
+            continue;
+        }
+        variants.push_back(pair<pair<double, int>, string>(
+                pair<double, int>(lexical_cast<double>(parts[0]), lexical_cast<int>(parts[1])), (directory / parts[2]).string()));
+    }
+    return variants;
+}
+
+string database_filename_from_input(const program_options::variables_map& input)
+{
+    string filename = input["database-filename"].as<string> ();
+    vector<pair<pair<double, int>, string> > variants = read_database_variants(filename);
+    if(variants.empty())
+    {
+        return filename;
+    }
+    double aspect_ratio = aspect_ratio_from_input(input["aspect-ratio"].as<string>());
+    int raster_resolution = lexical_cast<int>(input["raster-resolution"].as<string>());
+    std::stringstream available;
+    for(size_t i=0; i<variants.size(); ++i)
+    {
+        if(variants[i].first.second == raster_resolution and fabs(variants[i].first.first - aspect_ratio) < 1e-6 * aspect_ratio)
+        {
+            return variants[i].second;
+        }
+        available << " " << variants[i].first.first << "|" << variants[i].first.second;
+    }
+    throw std::runtime_error("No variant of " + filename + " has the requested aspect-ratio and raster-resolution. Available:" + available.str());
+}
+
+vector<string> database_filenames_in(const string& filename)
+{
+    vector<pair<pair<double, int>, string> > variants = read_database_variants(filename);
+    vector<string> filenames;
+    for(size_t i=0; i<variants.size(); ++i)
+    {
+        filenames.push_back(variants[i].second);
+    }
+    if(filenames.empty())
+    {
+        filenames.push_back(filename);
+    }
+    return filenames;
+}
+
+ImageFilePathIterator::~ImageFilePathIterator() {}
+
+bool has_jpg_extension(const string& path)
+{
+    return iends_with(path, ".JPG");
+}
+
+boost::uint32_t fnv1a_hash(const string& text)
+{
+    boost::uint32_t hash = 2166136261u;
+    for(string::const_iterator c = text.begin(); c != text.end(); ++c)
+    {
+        hash ^= static_cast<unsigned char>(*c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool indexed_in_all(const vector<DatabaseVariantPtr>& variants, const string& path)
+{
+    BOOST_FOREACH(DatabaseVariantPtr variant, variants)
+    {
+        if(not variant->already_indexed(path))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void add_stones_to_database(const vector<DatabaseVariantPtr>* variants, ImageFilePathIteratorPtr image_file_it, const ShardFilter* shard_filter)
+{
+    while(true)
+    {
+        try
+        {
+            string current_path = image_file_it->get_next();
+            int i = image_file_it->counter();
+            if (not shard_filter->in_shard(current_path))
+            {
+                continue;
+            }
+            if (indexed_in_all(*variants, current_path))
+            {
+                cout << i << " " << current_path << " ... "<< "Already in database ==> skipped" << std::endl;
+            }
+            else if (has_jpg_extension(current_path))
+            {
+                add_mosaic_stone_to_databases(*variants, i, current_path);
+            }
+            else
+            {
+                cout << i << " " << current_path << " ... "<< "No JPG ==> NOT Added" << std::endl;
+            }
+        }
+        catch (StopIteration&) {
+            break;
+        }
+    }
+}
+
+void replace_file(const string& filename, const string& contents)
+{
+    string temporary_filename = filename + ".tmp";
+    {
+        ofstream file(temporary_filename.c_str());
+        file << contents;
+        if(not file.flush())
+        {
+            throw std::runtime_error("Cannot write " + temporary_filename + ".");
+        }
+    }
+    move_into_place(temporary_filename, filename);
+}
+
+vector<string> build_database(ImageFilePathIteratorPtr image_file_it, const string& output_filename, const vector<string>& aspect_ratios,
+        const vector<int>& raster_resolutions, int number_of_threads, const ShardFilter& shard_filter, bool resume)
+{
+    vector<DatabaseVariantPtr> variants;
+    std::stringstream manifest;
+    manifest.precision(17);
+    manifest << DATABASE_VARIANTS_HEADER << endl;
+    BOOST_FOREACH(const string& aspect_ratio, aspect_ratios)
+    {
+        BOOST_FOREACH(int raster_resolution, raster_resolutions)
+        {
+            string filename = output_filename;
+            if(aspect_ratios.size() * raster_resolutions.size() > 1)
+            {
+                filename += "." + aspect_ratio + "-" + lexical_cast<string>(raster_resolution);
+                manifest << aspect_ratio_from_input(aspect_ratio) << "|" << raster_resolution << "|"
+                         << filesystem::path(filename).filename().string() << endl;
+            }
+            variants.push_back(DatabaseVariantPtr(new DatabaseVariant(filename, aspect_ratio_from_input(aspect_ratio), raster_resolution, resume)));
+        }
+    }
+    if(variants.size() > 1)
+    {
+        replace_file(output_filename, manifest.str());
+    }
+
+    ThreadList thread_list;
+    for(int i=0;i<number_of_threads;++i)
+    {
+        thread_list.push_back(ThreadPtr(new boost::thread(add_stones_to_database, &variants, image_file_it, &shard_filter)));
+    }
+    BOOST_FOREACH(ThreadPtr thread, thread_list)
+    {
+        thread->join();
+    }
+
+    vector<string> filenames;
+    BOOST_FOREACH(DatabaseVariantPtr variant, variants)
+    {
+        filenames.push_back(variant->filename());
+    }
+    return filenames;
+}
+
+typedef boost::uint64_t PerceptualHash;
+
+const int PERCEPTUAL_HASH_RESOLUTION = 8;
+
+PerceptualHash perceptual_hash_from_image_path(const string& path, double aspect_ratio)
+{
+    MosaicStone thumbnail(path, PERCEPTUAL_HASH_RESOLUTION, PERCEPTUAL_HASH_RESOLUTION, aspect_ratio);
+    const int cell_count = PERCEPTUAL_HASH_RESOLUTION*PERCEPTUAL_HASH_RESOLUTION;
+    vector<int> luminance(cell_count);
+    long sum = 0;
+    for(int i=0; i<cell_count; ++i)
+    {
+        luminance[i] = thumbnail[i + RED_CHANNEL_INDEX*cell_count] +
+                       thumbnail[i + GREEN_CHANNEL_INDEX*cell_count] +
+                       thumbnail[i + BLUE_CHANNEL_INDEX*cell_count];
+        sum += luminance[i];
+    }
+    PerceptualHash hash = 0;
+    for(int i=0; i<cell_count; ++i)
+    {
+        if(luminance[i]*cell_count > sum)
+        {
+            hash |= PerceptualHash(1) << i;
+        }
+    }
+    return hash;
+}
+
+int hamming_distance(PerceptualHash a, PerceptualHash b)
+{
+    int distance = 0;
+    for(PerceptualHash difference = a ^ b; difference != 0; difference &= difference - 1)
+    {
+        ++distance;
+    }
+    return distance;
+}
+
+/**
+ * Greedy leader clustering: every stone is compared against the representatives
+ * kept so far and becomes a new representative only if none of them is closer
+ * than the threshold.
+ *
+ * Two stones whose sums of raster values differ by more than the threshold times
+ * the number of values cannot be that close. The representatives are therefore kept
+ * in buckets of that width by their sum, and a stone is only compared against its
+ * own bucket and the two next to it.
+ */
+class DuplicateDetector
+{
+public:
+    DuplicateDetector(int raster_value_count, int duplicate_threshold, double aspect_ratio,
+            bool confirm_with_perceptual_hash, int max_perceptual_hash_distance) :
+        max_deviation_(duplicate_threshold*duplicate_threshold*raster_value_count),
+        bucket_width_(std::max(1, duplicate_threshold*raster_value_count)),
+        aspect_ratio_(aspect_ratio),
+        confirm_with_perceptual_hash_(confirm_with_perceptual_hash),
+        max_perceptual_hash_distance_(max_perceptual_hash_distance) {}
+
+    bool is_duplicate(MosaicStonePtr stone)
+    {
+        int bucket = value_sum(stone->search_values()) / bucket_width_;
+        for(int neighbour = bucket - 1; neighbour <= bucket + 1; ++neighbour)
+        {
+            map<int, list<MosaicStonePtr> >::const_iterator representatives = representatives_.find(neighbour);
+            if(representatives == representatives_.end())
+            {
+                continue;
+            }
+            BOOST_FOREACH(const MosaicStonePtr& representative, representatives->second)
+            {
+                if(representative->calc_deviation(stone->search_values(), max_deviation_ + 1) != -1 and
+                   (not confirm_with_perceptual_hash_ or perceptual_hashes_match(representative, stone)))
+                {
+                    return true;
+                }
+            }
+        }
+        representatives_[bucket].push_back(stone);
+        return false;
+    }
+
+private:
+    static int value_sum(const vector<int>& values)
+    {
+        int sum = 0;
+        BOOST_FOREACH(int value, values)
+        {
+            sum += value;
+        }
+        return sum;
+    }
+
+    bool perceptual_hashes_match(MosaicStonePtr a, MosaicStonePtr b)
+    {
+        try
+        {
+            return hamming_distance(perceptual_hash(a), perceptual_hash(b)) <= max_perceptual_hash_distance_;
+        }
+        catch(std::exception& error)
+        {
+            cerr << "Error computing perceptual hash: " << error.what() << " ==> keeping stone" << endl;
+            return false;
+        }
+    }
+
+    PerceptualHash perceptual_hash(MosaicStonePtr stone)
+    {
+        map<int, PerceptualHash>::const_iterator cached = perceptual_hashes_.find(stone->id());
+        if(cached != perceptual_hashes_.end())
+        {
+            return cached->second;
+        }
+        PerceptualHash hash = perceptual_hash_from_image_path(stone->image_file_path(), aspect_ratio_);
+        perceptual_hashes_[stone->id()] = hash;
+        return hash;
+    }
+
+    int max_deviation_;
+    int bucket_width_;
+    double aspect_ratio_;
+    bool confirm_with_perceptual_hash_;
+    int max_perceptual_hash_distance_;
+    // By the sum of their raster values divided by bucket_width_.
+    map<int, list<MosaicStonePtr> > representatives_;
+    map<int, PerceptualHash> perceptual_hashes_;
+};
+
+void compact_database(const string& input_filename, const string& output_filename, int duplicate_threshold,
+        bool confirm_with_perceptual_hash, int max_perceptual_hash_distance)
+{
+    MosaicsDatabase source_database(input_filename);
+    int raster_resolution = source_database.raster_resolution();
+    DuplicateDetector duplicate_detector(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS, duplicate_threshold,
+            source_database.aspect_ratio(), confirm_with_perceptual_hash, max_perceptual_hash_distance);
+
+    // The output may be the input, which must survive until the compacted database is complete.
+    string temporary_filename = output_filename + ".tmp";
+    size_t removed = 0;
+    {
+        MosaicsDatabase compacted_database(temporary_filename, source_database.aspect_ratio(), raster_resolution);
+        BOOST_FOREACH(MosaicStonePtr stone, source_database.stones())
+        {
+            if(duplicate_detector.is_duplicate(stone))
+            {
+                cout << stone->image_file_path() << " ... Near-duplicate ==> removed" << endl;
+                ++removed;
+            }
+            else
+            {
+                compacted_database.add_mosaic_stone(stone);
+            }
+        }
+        compacted_database.flush();
+    }
+    move_into_place(temporary_filename, output_filename);
+    size_t total = source_database.stones().size();
+    cout << "Compacted database from " << total << " to " << total - removed << " stones ("
+         << (total == 0 ? 0.0 : 100.0 * removed / total) << "% removed)." << endl;
+}
+
+void merge_database(const vector<string>& input_filenames, const string& output_filename)
+{
+    if(input_filenames.empty())
+    {
+        throw std::runtime_error("No input-database was specified.");
+    }
+    list<boost::shared_ptr<MosaicsDatabase> > input_databases;
+    BOOST_FOREACH(const string& input_filename, input_filenames)
+    {
+        input_databases.push_back(boost::shared_ptr<MosaicsDatabase>(new MosaicsDatabase(input_filename)));
+        if(not input_databases.back()->is_compatible_with(input_databases.front()->aspect_ratio(), input_databases.front()->raster_resolution()))
+        {
+            throw std::runtime_error(input_filename + " uses a different aspect ratio or raster resolution than " + input_filenames.front() + ".");
+        }
+    }
+
+    // The output may be one of the inputs, which must survive until the merged database is complete.
+    string temporary_filename = output_filename + ".tmp";
+    std::set<string> merged_paths;
+    size_t skipped = 0;
+    {
+        MosaicsDatabase merged_database(temporary_filename, input_databases.front()->aspect_ratio(), input_databases.front()->raster_resolution());
+        BOOST_FOREACH(boost::shared_ptr<MosaicsDatabase> input_database, input_databases)
+        {
+            BOOST_FOREACH(MosaicStonePtr stone, input_database->stones())
+            {
+                if(merged_paths.insert(stone->image_file_path()).second)
+                {
+                    merged_database.add_mosaic_stone(stone);
+                }
+                else
+                {
+                    ++skipped;
+                }
+            }
+        }
+        merged_database.flush();
+    }
+    move_into_place(temporary_filename, output_filename);
+    cout << "Merged " << input_databases.size() << " databases into " << merged_paths.size() << " stones ("
+         << skipped << " duplicate paths skipped)." << endl;
+}
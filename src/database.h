@@ -0,0 +1,638 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * The database of mosaic stones: reading and writing it, and building, merging and
+ * compacting it from photos.
+ */
+#ifndef PHOMO_DATABASE_H
+#define PHOMO_DATABASE_H
+
+#include "image.h"
+
+#include <boost/lockfree/queue.hpp>
+
+#include <dirent.h>
+
+class MosaicStone
+{
+    string image_file_path_;
+    vector<int> raster_values_;
+    // The raster values in the order the database compares them, see MosaicsDatabase::order_dimensions_by_variance().
+    vector<int> search_values_;
+    int id_;
+    StoneSource source_;
+    bool has_source_;
+public:
+    MosaicStone() : has_source_(false) {}
+    MosaicStone(const string &image_file_path, const vector<int>& raster_values, int id, const StoneSource* source = NULL) :
+        image_file_path_(image_file_path),
+        raster_values_(raster_values),
+        search_values_(raster_values),
+        id_(id),
+        has_source_(source != NULL)
+    {
+        if(source != NULL)
+        {
+            source_ = *source;
+        }
+    }
+
+    MosaicStone(const string &image_file_path, int col_count, int row_count, double aspect_ratio) :
+        image_file_path_(image_file_path),
+        raster_values_(col_count*row_count*NUMBER_OF_CHANNELS, 0),
+        has_source_(false)
+    {
+        timer.restart();
+        Orientation orientation = orientation_from_image_path(image_file_path);
+        gil::point2<std::ptrdiff_t> dimensions = aspect_ratio_cropped_dimensions(image_file_path, aspect_ratio, orientation);
+
+        gil::rgb8_image_t source_image;
+        gil::jpeg_read_and_convert_image(image_file_path, source_image);
+        timer.print_elapsed_with_label("Load image");
+        timer.restart();
+        raster_values_from_image(const_view(source_image), orientation, dimensions, col_count, row_count, raster_values_);
+        search_values_ = raster_values_;
+        timer.print_elapsed_with_label("raster_value_from_view");
+    }
+
+    /**
+     * Takes the raster values from an already decoded photo, so that one decode serves several
+     * databases. stamp is the one the photo had before it was decoded.
+     */
+    MosaicStone(const string &image_file_path, const gil::rgb8c_view_t& source_view, Orientation orientation,
+            const FileStamp& stamp, int col_count, int row_count, double aspect_ratio) :
+        image_file_path_(image_file_path),
+        raster_values_(col_count*row_count*NUMBER_OF_CHANNELS, 0),
+        has_source_(true)
+    {
+        source_.orientation = orientation;
+        source_.photo_dimensions = source_view.dimensions();
+        source_.crop_position = Position(0, 0);
+        source_.crop_dimensions = aspect_ratio_cropped_dimensions(source_view.dimensions(), aspect_ratio, orientation);
+        source_.stamp = stamp;
+        raster_values_from_image(source_view, orientation, source_.crop_dimensions, col_count, row_count, raster_values_);
+        search_values_ = raster_values_;
+    }
+
+    void set_id(int id) { id_=id; }
+    int id() const { return id_; }
+
+    const string& image_file_path() const { return image_file_path_; }
+
+    /// NULL for stones from databases that were built before their sources were stored.
+    const StoneSource* source() const { return has_source_ ? &source_ : NULL; }
+
+    int operator[](int index) const { return raster_values_[index]; }
+    const vector<int>& raster_values() const { return raster_values_; }
+    const vector<int>& search_values() const { return search_values_; }
+//    vector<int>& operator[](int index) { return raster_values_[index]; }
+
+    void set_search_order(const vector<int>& order)
+    {
+        for(size_t i=0; i<order.size(); ++i)
+        {
+            search_values_[i] = raster_values_[order[i]];
+        }
+    }
+
+    /// b must be in search order. values_examined, if given, is increased by the number of values compared.
+    int calc_deviation(const vector<int>& b, int best_deviation, long* values_examined = NULL) const
+    {
+        assert(search_values_.size() == b.size());
+        int deviation = 0;
+        for(size_t i=0; i<search_values_.size();++i)
+        {
+            deviation += (search_values_[i]-b[i])*(search_values_[i]-b[i]);
+
+            if(deviation>=best_deviation and best_deviation!=-1)
+            {
+                if(values_examined != NULL)
+                {
+                    *values_examined += i + 1;
+                }
+                return -1;
+            }
+        }
+        if(values_examined != NULL)
+        {
+            *values_examined += search_values_.size();
+        }
+        return deviation;
+    }
+};
+
+typedef boost::shared_ptr<MosaicStone> MosaicStonePtr;
+
+class MosaicsDatabase
+{
+public:
+    /// verbose prints every line that is read, as the command line always did, and every malformed line that is skipped.
+    MosaicsDatabase(const string& db_filename, bool verbose = true) /*:
+        file_(db_filename.c_str(), std::ios_base::in)*/
+    {
+        file_.open(db_filename.c_str(), std::ios_base::in);
+        if(!file_)
+        {
+            throw std::runtime_error("Cannot open database " + db_filename + ".");
+        }
+        if(not (file_ >> aspect_ratio_ >> raster_resolution_))
+        {
+            throw std::runtime_error(db_filename + " is not a database. A manifest of database variants is only understood by render, build-index and build-atlas.");
+        }
+        checksum_ = content_checksum(lexical_cast<string>(aspect_ratio_) + "\n" + lexical_cast<string>(raster_resolution_) + "\n");
+        string line;
+        std::getline(file_, line);
+        int line_number = 1;
+        while(std::getline(file_, line))
+        {
+            checksum_ = content_checksum(line + "\n", checksum_);
+            if(line == "")
+            {
+                continue;
+            }
+            if(verbose)
+            {
+                cout << line << endl;
+            }
+            vector<string> parts;
+            split(parts, line, is_any_of("|"));
+
+            // A build that was interrupted may have left a truncated last line behind.
+            size_t value_field_count = raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS + 1;
+            if(parts.size() != value_field_count and parts.size() != value_field_count + StoneSource::FIELD_COUNT)
+            {
+                if(verbose)
+                {
+                    cerr << "Malformed database line: " << line << " ==> skipping" << endl;
+                }
+                continue;
+            }
+            string image_file_path = parts[0];
+            vector<int> values(raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS);
+            for(int i=0;i<raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS;++i)
+            {
+                values[i] = lexical_cast<int>(parts[i+1]);
+            }
+            StoneSource source;
+            if(parts.size() > value_field_count)
+            {
+                source.read(parts, value_field_count);
+            }
+            stones_.push_back(MosaicStonePtr(new MosaicStone(image_file_path, values, line_number,
+                    parts.size() > value_field_count ? &source : NULL)));
+            stones_by_id_.push_back(stones_.back());
+            line_number++;
+        }
+        order_dimensions_by_variance();
+    }
+
+    MosaicsDatabase(const string& db_filename, double aspect_ratio, int raster_resolution) :
+        file_(db_filename.c_str(), std::ios_base::out | std::ios_base::trunc), raster_resolution_(raster_resolution), aspect_ratio_(aspect_ratio),
+        cached_raster_value_count_(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS), checksum_(EMPTY_CHECKSUM)
+    {
+        file_ << aspect_ratio << endl;
+        file_ << raster_resolution << endl;
+    }
+
+    double aspect_ratio() const { return aspect_ratio_; }
+
+    double raster_resolution() const { return raster_resolution_; }
+
+    /// Brings raster values into the order in which the stones of this database compare them.
+    void to_search_order(const vector<int>& raster_values, vector<int>& search_values) const
+    {
+        for(size_t i=0; i<dimension_order_.size(); ++i)
+        {
+            search_values[i] = raster_values[dimension_order_[i]];
+        }
+    }
+
+    /// Databases store the aspect ratio with six significant digits only.
+    bool is_compatible_with(double aspect_ratio, int raster_resolution) const
+    {
+        return raster_resolution_ == raster_resolution and fabs(aspect_ratio_ - aspect_ratio) < 1e-5 * aspect_ratio;
+    }
+
+    void add_mosaic_stone(MosaicStonePtr mosaic_stone)
+    {
+        boost::mutex::scoped_lock lock(io_mutex);
+        file_ << mosaic_stone->image_file_path();
+        for(int i=0; i < cached_raster_value_count_; ++i)
+        {
+            file_ << "|" << (*mosaic_stone)[i];
+        }
+        if(mosaic_stone->source() != NULL)
+        {
+            mosaic_stone->source()->write(file_);
+        }
+        file_ << endl;
+        stones_.push_back(mosaic_stone);
+    }
+
+    /// Throws if the stones added so far could not all be written.
+    void flush()
+    {
+        boost::mutex::scoped_lock lock(io_mutex);
+        if(not file_.flush())
+        {
+            throw std::runtime_error("Cannot write the database.");
+        }
+    }
+
+    const list<MosaicStonePtr>& stones() const { return stones_; }
+
+    /**
+     * Of the contents of the file the database was read from. Files derived from the database
+     * store it to notice that the database was rebuilt, even with the same number of stones.
+     */
+    boost::uint64_t checksum() const { return checksum_; }
+
+    /// Only available for databases that were read from a file, where ids are line numbers.
+    MosaicStonePtr stone_by_id(int id) const
+    {
+        if(id < 1 or (size_t)id > stones_by_id_.size())
+        {
+            throw std::runtime_error("Unknown stone id " + lexical_cast<string>(id) + ".");
+        }
+        return stones_by_id_[id - 1];
+    }
+
+private:
+    /**
+     * Deviations are summed up in order of decreasing variance of the raster values
+     * across the database, so that the early exit of MosaicStone::calc_deviation()
+     * is reached after as few values as possible. The sum itself does not change.
+     */
+    void order_dimensions_by_variance()
+    {
+        int value_count = raster_resolution_*raster_resolution_*NUMBER_OF_CHANNELS;
+        vector<double> sums(value_count, 0.0);
+        vector<double> squared_sums(value_count, 0.0);
+        BOOST_FOREACH(MosaicStonePtr stone, stones_)
+        {
+            for(int i=0; i<value_count; ++i)
+            {
+                sums[i] += (*stone)[i];
+                squared_sums[i] += (double)(*stone)[i] * (*stone)[i];
+            }
+        }
+        vector<pair<double, int> > variances(value_count);
+        for(int i=0; i<value_count; ++i)
+        {
+            double mean = stones_.empty() ? 0 : sums[i] / stones_.size();
+            double variance = stones_.empty() ? 0 : squared_sums[i] / stones_.size() - mean * mean;
+            variances[i] = pair<double, int>(-variance, i);
+        }
+        std::sort(variances.begin(), variances.end());
+        dimension_order_.resize(value_count);
+        for(int i=0; i<value_count; ++i)
+        {
+            dimension_order_[i] = variances[i].second;
+        }
+        BOOST_FOREACH(MosaicStonePtr stone, stones_)
+        {
+            stone->set_search_order(dimension_order_);
+        }
+    }
+
+    std::fstream file_;
+    list<MosaicStonePtr> stones_;
+    vector<MosaicStonePtr> stones_by_id_;
+    vector<int> dimension_order_;
+    int raster_resolution_;
+    double aspect_ratio_;
+    int cached_raster_value_count_;
+    boost::uint64_t checksum_;
+    boost::mutex io_mutex;
+};
+
+double aspect_ratio_from_input(const string& input);
+
+/// Renames the finished temporary_filename to filename, which it replaces in one step.
+void move_into_place(const string& temporary_filename, const string& filename);
+
+/**
+ * One of the databases build-database writes, for one combination of aspect ratio and
+ * raster resolution.
+ */
+class DatabaseVariant
+{
+public:
+    DatabaseVariant(const string& filename, double aspect_ratio, int raster_resolution, bool resume) :
+        filename_(filename), aspect_ratio_(aspect_ratio), raster_resolution_(raster_resolution)
+    {
+        list<MosaicStonePtr> indexed_stones;
+        if(resume and filesystem::exists(filename))
+        {
+            MosaicsDatabase indexed_database(filename);
+            if(not indexed_database.is_compatible_with(aspect_ratio, raster_resolution))
+            {
+                throw std::runtime_error("Cannot resume: " + filename + " uses a different aspect ratio or raster resolution.");
+            }
+            indexed_stones = indexed_database.stones();
+        }
+
+        // Rewriting the stones that survived the interruption also drops a truncated last line. They
+        // are rewritten to a temporary file that then replaces the database, so that an interruption
+        // of the rewrite loses none of them. New stones are appended to the renamed file.
+        string temporary_filename = filename + ".tmp";
+        database_.reset(new MosaicsDatabase(temporary_filename, aspect_ratio, raster_resolution));
+        BOOST_FOREACH(MosaicStonePtr stone, indexed_stones)
+        {
+            database_->add_mosaic_stone(stone);
+            indexed_paths_.insert(stone->image_file_path());
+        }
+        move_into_place(temporary_filename, filename);
+    }
+
+    const string& filename() const { return filename_; }
+
+    bool already_indexed(const string& path) const
+    {
+        return indexed_paths_.count(path) != 0;
+    }
+
+    MosaicStonePtr create_mosaic_stone(const string& path, const gil::rgb8c_view_t& source_view, Orientation orientation, const FileStamp& stamp) const
+    {
+        return MosaicStonePtr(new MosaicStone(path, source_view, orientation, stamp, raster_resolution_, raster_resolution_, aspect_ratio_));
+    }
+
+    void add_mosaic_stone(MosaicStonePtr mosaic_stone) { database_->add_mosaic_stone(mosaic_stone); }
+
+private:
+    string filename_;
+    double aspect_ratio_;
+    int raster_resolution_;
+    boost::shared_ptr<MosaicsDatabase> database_;
+    std::set<string> indexed_paths_;
+};
+
+typedef boost::shared_ptr<DatabaseVariant> DatabaseVariantPtr;
+
+/**
+ * The database render uses. If database-filename is a manifest of database variants, this
+ * is the variant with the aspect-ratio and raster-resolution render was given.
+ */
+string database_filename_from_input(const program_options::variables_map& input);
+
+/// The databases filename stands for, which is either a database or a manifest of database variants.
+vector<string> database_filenames_in(const string& filename);
+
+class ImageFilePathIterator
+{
+public:
+    virtual ~ImageFilePathIterator() = 0;
+    virtual string get_next() = 0;
+    virtual int counter() const = 0;
+};
+
+typedef boost::shared_ptr<ImageFilePathIterator> ImageFilePathIteratorPtr;
+
+class StopIteration {};
+
+typedef boost::shared_ptr<boost::thread> ThreadPtr;
+typedef list<ThreadPtr> ThreadList;
+
+bool has_jpg_extension(const string& path);
+
+/**
+ * Walks a directory tree with several scanner threads at once. Scanners take
+ * directories from a shared lock-free queue, use the d_type of directory entries
+ * instead of stat'ing every file and only hand out paths with a JPG extension.
+ */
+class ParallelDirectoryImageFilePathIterator : public ImageFilePathIterator
+{
+    boost::lockfree::queue<string*> directories_;
+    boost::lockfree::queue<string*> paths_;
+    // Directories queued or being scanned. Paths are always queued before the
+    // directory they were found in is counted as done.
+    boost::atomic<int> pending_directories_;
+    boost::atomic<bool> stopping_;
+    boost::atomic<int> i_;
+    ThreadList scanners_;
+
+public:
+    ParallelDirectoryImageFilePathIterator(const string& photos_dir_path, int number_of_threads) :
+        directories_(128), paths_(1024), pending_directories_(1), stopping_(false), i_(0)
+    {
+        if(number_of_threads < 1)
+        {
+            // Without a scanner, get_next() would wait for the first directory forever.
+            throw std::runtime_error("discovery-threads must be at least 1.");
+        }
+        directories_.push(new string(photos_dir_path));
+        for(int i=0; i<number_of_threads; ++i)
+        {
+            scanners_.push_back(ThreadPtr(new boost::thread(&ParallelDirectoryImageFilePathIterator::scan, this)));
+        }
+    }
+
+    virtual ~ParallelDirectoryImageFilePathIterator()
+    {
+        stopping_ = true;
+        BOOST_FOREACH(ThreadPtr scanner, scanners_)
+        {
+            scanner->join();
+        }
+        string* path;
+        while(directories_.pop(path))
+        {
+            delete path;
+        }
+        while(paths_.pop(path))
+        {
+            delete path;
+        }
+    }
+
+    virtual string get_next() {
+        string* path;
+        while(not paths_.pop(path))
+        {
+            if(pending_directories_ == 0)
+            {
+                if(paths_.pop(path))
+                {
+                    break;
+                }
+                throw StopIteration();
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+        string result(*path);
+        delete path;
+        ++i_;
+        return result;
+    }
+
+    virtual int counter() const {
+        return i_;
+    }
+
+private:
+    void scan()
+    {
+        while(pending_directories_ != 0 and not stopping_)
+        {
+            string* directory_path;
+            if(directories_.pop(directory_path))
+            {
+                scan_directory(*directory_path);
+                delete directory_path;
+                --pending_directories_;
+            }
+            else
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            }
+        }
+    }
+
+    void scan_directory(const string& directory_path)
+    {
+        DIR* directory = opendir(directory_path.c_str());
+        if(directory == NULL)
+        {
+            cerr << "Cannot read directory " << directory_path << ": " << strerror(errno) << " ==> skipping" << endl;
+            return;
+        }
+        string prefix = iends_with(directory_path, "/") ? directory_path : directory_path + "/";
+        while(struct dirent* entry = readdir(directory))
+        {
+            if(strcmp(entry->d_name, ".") == 0 or strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+            string path = prefix + entry->d_name;
+            unsigned char type = entry->d_type;
+            if(type == DT_UNKNOWN)
+            {
+                type = file_type_from_lstat(path);
+            }
+            if(type == DT_DIR)
+            {
+                ++pending_directories_;
+                directories_.push(new string(path));
+            }
+            else if((type == DT_REG or type == DT_LNK) and has_jpg_extension(path))
+            {
+                paths_.push(new string(path));
+            }
+        }
+        closedir(directory);
+    }
+
+    static unsigned char file_type_from_lstat(const string& path)
+    {
+        struct stat status;
+        if(lstat(path.c_str(), &status) != 0)
+        {
+            return DT_UNKNOWN;
+        }
+        if(S_ISDIR(status.st_mode))
+        {
+            return DT_DIR;
+        }
+        if(S_ISLNK(status.st_mode))
+        {
+            return DT_LNK;
+        }
+        return S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+};
+
+class InputStreamImageFilePathIterator : public ImageFilePathIterator
+{
+    int i;
+    boost::shared_ptr<std::istream> inputStream_;
+    bool done_;
+    mutable boost::mutex mutex_;
+public:
+    InputStreamImageFilePathIterator(boost::shared_ptr<std::istream> inputStream) : i(0), inputStream_(inputStream), done_(false) {}
+    virtual string get_next() {
+        string result;
+        boost::mutex::scoped_lock lock(mutex_);
+        if(done_)
+        {
+            throw StopIteration();
+        }
+        std::getline(*inputStream_, result);
+        if (result.empty())
+        {
+            done_ = true;
+            throw StopIteration();
+        }
+        i++;
+        return result;
+    }
+
+    virtual int counter() const {
+        boost::mutex::scoped_lock lock(mutex_);
+        return i;
+    }
+};
+
+boost::uint32_t fnv1a_hash(const string& text);
+
+/**
+ * Decides which photos a build-database run indexes: only the ones of its own shard
+ * and, when resuming, only the ones not yet in the database. The hash must not
+ * depend on the platform, so that runs on different machines agree on the shards.
+ */
+class ShardFilter
+{
+    int shard_index_;
+    int shard_count_;
+public:
+    ShardFilter(int shard_index, int shard_count) :
+        shard_index_(shard_index), shard_count_(shard_count)
+    {
+        if(shard_count < 1 or shard_index < 0 or shard_index >= shard_count)
+        {
+            throw std::runtime_error("shard-index must be between 0 and shard-count - 1.");
+        }
+    }
+
+    bool in_shard(const string& path) const
+    {
+        return fnv1a_hash(path) % shard_count_ == (boost::uint32_t)shard_index_;
+    }
+};
+
+/**
+ * Writes contents to a temporary file that then replaces filename, so that an interruption
+ * never leaves a truncated file behind.
+ */
+void replace_file(const string& filename, const string& contents);
+
+/**
+ * Builds a database for every combination of aspect_ratios and raster_resolutions, decoding
+ * every photo only once. A single combination is written to output_filename. More are
+ * written next to it, with output_filename as the manifest of the variants.
+ * Returns the filenames of the databases.
+ */
+vector<string> build_database(ImageFilePathIteratorPtr image_file_it, const string& output_filename, const vector<string>& aspect_ratios,
+        const vector<int>& raster_resolutions, int number_of_threads, const ShardFilter& shard_filter, bool resume);
+
+void compact_database(const string& input_filename, const string& output_filename, int duplicate_threshold,
+        bool confirm_with_perceptual_hash, int max_perceptual_hash_distance);
+
+void merge_database(const vector<string>& input_filenames, const string& output_filename);
+
+#endif
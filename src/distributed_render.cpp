@@ -0,0 +1,576 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Rendering a mosaic across worker processes, which render-worker serves and render
+ * starts with --workers or --local-workers.
+ */
+
+#include "phomo_actions.h"
+#include "render.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/**
+ * Minimal buffered stream over a socket, used to talk to render workers.
+ */
+class SocketStream
+{
+public:
+    explicit SocketStream(int fd) : fd_(fd), begin_(0), end_(0) {}
+
+    ~SocketStream() { close(fd_); }
+
+    /// Returns false if the other side closed the connection before a line started.
+    bool read_line(string& line)
+    {
+        line.clear();
+        while(true)
+        {
+            if(begin_ == end_ and not fill())
+            {
+                if(line.empty())
+                {
+                    return false;
+                }
+                throw std::runtime_error("Connection closed in the middle of a message.");
+            }
+            char c = buffer_[begin_++];
+            if(c == '\n')
+            {
+                return true;
+            }
+            line += c;
+        }
+    }
+
+    string read_line()
+    {
+        string line;
+        if(not read_line(line))
+        {
+            throw std::runtime_error("Connection closed unexpectedly.");
+        }
+        return line;
+    }
+
+    void read(char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            if(begin_ == end_ and not fill())
+            {
+                throw std::runtime_error("Connection closed in the middle of a message.");
+            }
+            size_t chunk = std::min(size, end_ - begin_);
+            memcpy(data, buffer_ + begin_, chunk);
+            begin_ += chunk;
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    void write(const string& text)
+    {
+        write(text.data(), text.size());
+    }
+
+    void write(const char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t written = send(fd_, data, size, MSG_NOSIGNAL);
+            if(written < 0 and errno != EINTR)
+            {
+                throw std::runtime_error(string("Cannot send to worker connection: ") + strerror(errno));
+            }
+            if(written > 0)
+            {
+                data += written;
+                size -= written;
+            }
+        }
+    }
+
+private:
+    bool fill()
+    {
+        ssize_t received;
+        do
+        {
+            received = recv(fd_, buffer_, sizeof(buffer_), 0);
+        } while(received < 0 and errno == EINTR);
+        if(received < 0)
+        {
+            throw std::runtime_error(string("Cannot receive from worker connection: ") + strerror(errno));
+        }
+        begin_ = 0;
+        end_ = received;
+        return received > 0;
+    }
+
+    int fd_;
+    char buffer_[65536];
+    size_t begin_;
+    size_t end_;
+};
+
+typedef boost::shared_ptr<SocketStream> SocketStreamPtr;
+
+/**
+ * A band of rows of the mosaic a worker renders, together with the stones already placed
+ * within min-distance of it.
+ *
+ * On the wire, a job is a "job" line followed by one line per field and one "x y id" line
+ * per fixed stone. A worker answers with an "ok" line, a line with the ids of the stones it
+ * placed and a "width height" line followed by the raw RGB pixels of the band, or with
+ * an "error <message>" line.
+ */
+struct RenderJob
+{
+    string picture_path;
+    size_t stone_count;
+    boost::uint64_t database_checksum;
+    int output_width;
+    int x_resolution_in_stones;
+    int min_distance;
+    int first_row;
+    int row_count;
+    vector<PlacedStone> fixed_stones;
+
+    void write(SocketStream& connection) const
+    {
+        std::stringstream message;
+        message << "job" << endl << picture_path << endl << stone_count << " " << database_checksum << endl
+                << output_width << " " << x_resolution_in_stones << " " << min_distance << endl
+                << first_row << " " << row_count << endl << fixed_stones.size() << endl;
+        BOOST_FOREACH(const PlacedStone& fixed_stone, fixed_stones)
+        {
+            message << fixed_stone.position.x << " " << fixed_stone.position.y << " " << fixed_stone.stone_id << endl;
+        }
+        connection.write(message.str());
+    }
+
+    /// Returns false if the coordinator has closed the connection.
+    bool read(SocketStream& connection)
+    {
+        string line;
+        if(not connection.read_line(line))
+        {
+            return false;
+        }
+        if(line != "job")
+        {
+            throw std::runtime_error("Unexpected message from coordinator: " + line);
+        }
+        picture_path = connection.read_line();
+        std::stringstream fields;
+        for(int i=0; i<4; ++i)
+        {
+            fields << connection.read_line() << " ";
+        }
+        size_t fixed_stone_count;
+        fields >> stone_count >> database_checksum >> output_width >> x_resolution_in_stones >> min_distance >> first_row >> row_count >> fixed_stone_count;
+        fixed_stones.resize(fixed_stone_count);
+        for(size_t i=0; i<fixed_stone_count; ++i)
+        {
+            std::stringstream fixed_stone(connection.read_line());
+            fixed_stone >> fixed_stones[i].position.x >> fixed_stones[i].position.y >> fixed_stones[i].stone_id;
+        }
+        if(not fields)
+        {
+            throw std::runtime_error("Malformed job from coordinator.");
+        }
+        return true;
+    }
+};
+
+/**
+ * Renders jobs received over connection until the coordinator closes it. The database
+ * is loaded once for all jobs.
+ */
+void serve_render_jobs(SocketStream& connection, const program_options::variables_map& input)
+{
+    string database_filename = database_filename_from_input(input);
+    MosaicsDatabase mosaics_database(database_filename);
+    boost::shared_ptr<InvertedFileIndex> index;
+    if(input["search-probes"].as<int>() > 0)
+    {
+        index.reset(new InvertedFileIndex(index_filename_from_database_filename(database_filename), mosaics_database));
+    }
+    StoneSearcher searcher(mosaics_database, index.get(), input["search-probes"].as<int>(), false);
+    boost::shared_ptr<TileAtlas> atlas = atlas_from_input(input, mosaics_database, database_filename);
+    Renderer renderer(mosaics_database, searcher, input["number-of-threads"].as<int>(), input["prefetch-window"].as<int>(),
+            input["candidates-per-tile"].as<int>(), atlas.get());
+
+    string loaded_picture_path;
+    gil::rgb8_image_t source_image;
+    Orientation orientation = NOT_ROTATED;
+    RenderJob job;
+    while(job.read(connection))
+    {
+        try
+        {
+            if(job.stone_count != mosaics_database.stones().size() or job.database_checksum != mosaics_database.checksum())
+            {
+                throw std::runtime_error("Worker database differs from the coordinator's.");
+            }
+            if(job.picture_path != loaded_picture_path)
+            {
+                orientation = orientation_from_image_path(job.picture_path);
+                gil::jpeg_read_and_convert_image(job.picture_path, source_image);
+                loaded_picture_path = job.picture_path;
+            }
+            RenderSettings render_settings(swap_dimensions_if(const_view(source_image).dimensions(), orientation),
+                    job.output_width, job.x_resolution_in_stones, job.min_distance, mosaics_database.aspect_ratio());
+            render_settings.region_origin = Position(0, job.first_row);
+            render_settings.region_size = Dimensions(render_settings.resolution_in_stones.x, job.row_count);
+
+            JPG band(Dimensions(render_settings.output_dimensions.x, job.row_count * render_settings.output_stone_size.y));
+            OutputMatrix output = render_oriented(renderer, view(source_image), orientation, band, render_settings, false, NULL, &job.fixed_stones);
+
+            std::stringstream message;
+            message << "ok" << endl;
+            for(int y=job.first_row; y<job.first_row+job.row_count; ++y)
+            {
+                for(int x=0; x<output.xres(); ++x)
+                {
+                    message << output(x, y)->id() << " ";
+                }
+            }
+            message << endl << band.pixels().width() << " " << band.pixels().height() << endl;
+            connection.write(message.str());
+            connection.write(reinterpret_cast<const char*>(&band.pixels()(0, 0)), band.pixels().size() * NUMBER_OF_CHANNELS);
+        }
+        catch(std::exception& error)
+        {
+            string message(error.what());
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            connection.write("error " + message + "\n");
+        }
+    }
+}
+
+void run_render_worker(const program_options::variables_map& input)
+{
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    if(inet_pton(AF_INET, input["listen-address"].as<string>().c_str(), &address.sin_addr) != 1)
+    {
+        throw std::runtime_error("Not an IPv4 address: " + input["listen-address"].as<string>());
+    }
+    address.sin_port = htons(input["listen-port"].as<int>());
+    if(server == -1 or bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 or listen(server, 1) != 0)
+    {
+        throw std::runtime_error(string("Cannot listen for coordinators: ") + strerror(errno));
+    }
+    cout << "Waiting for coordinators on " << input["listen-address"].as<string>() << ":" << input["listen-port"].as<int>() << endl;
+    while(true)
+    {
+        int client = accept(server, NULL, NULL);
+        if(client == -1)
+        {
+            continue;
+        }
+        try
+        {
+            SocketStream connection(client);
+            serve_render_jobs(connection, input);
+        }
+        catch(std::exception& error)
+        {
+            cerr << "Error serving coordinator: " << error.what() << endl;
+        }
+    }
+}
+
+SocketStreamPtr connect_to_worker(const string& host_and_port)
+{
+    vector<string> parts;
+    split(parts, host_and_port, is_any_of(":"));
+    if(parts.size() != 2)
+    {
+        throw std::runtime_error("Workers must be given as host:port, not " + host_and_port + ".");
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    if(getaddrinfo(parts[0].c_str(), parts[1].c_str(), &hints, &addresses) != 0)
+    {
+        throw std::runtime_error("Cannot resolve worker " + host_and_port + ".");
+    }
+    int fd = -1;
+    for(struct addrinfo* address = addresses; address != NULL and fd == -1; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(fd != -1 and connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if(fd == -1)
+    {
+        throw std::runtime_error("Cannot connect to worker " + host_and_port + ".");
+    }
+    return SocketStreamPtr(new SocketStream(fd));
+}
+
+/// Must be called before any threads are started.
+SocketStreamPtr spawn_local_worker(const program_options::variables_map& input, list<pid_t>& worker_pids)
+{
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        throw std::runtime_error(string("Cannot create worker connection: ") + strerror(errno));
+    }
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        close(fds[0]);
+        try
+        {
+            SocketStream connection(fds[1]);
+            serve_render_jobs(connection, input);
+        }
+        catch(std::exception& error)
+        {
+            cerr << "Local worker failed: " << error.what() << endl;
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if(pid == -1)
+    {
+        close(fds[0]);
+        throw std::runtime_error(string("Cannot start local worker: ") + strerror(errno));
+    }
+    worker_pids.push_back(pid);
+    return SocketStreamPtr(new SocketStream(fds[0]));
+}
+
+/**
+ * Splits the mosaic into bands of rows and renders them on worker processes. Bands are
+ * at least min-distance rows high and rendered in two rounds, first the even and then
+ * the odd ones. Bands of the same round are therefore always more than min-distance
+ * apart, and an odd band only has to be told the stones of the even bands next to it.
+ */
+class DistributedRenderer
+{
+public:
+    DistributedRenderer(const list<SocketStreamPtr>& workers) : workers_(workers) {}
+
+    const vector<vector<int> >& stone_ids() const { return stone_ids_; }
+
+    void render(const RenderJob& job_template, const RenderSettings& render_settings, JPG& output_image)
+    {
+        int rows = render_settings.resolution_in_stones.y;
+        int band_height = std::max<int>(std::max<int>(render_settings.min_distance, 1),
+                (rows + 2 * workers_.size() - 1) / (2 * workers_.size()));
+        for(int first_row = 0; first_row < rows; first_row += band_height)
+        {
+            bands_.push_back(pair<int, int>(first_row, std::min(band_height, rows - first_row)));
+        }
+        stone_ids_.assign(rows, vector<int>(render_settings.resolution_in_stones.x, 0));
+        job_template_ = job_template;
+        render_settings_ = &render_settings;
+        output_image_ = &output_image;
+
+        for(size_t round = 0; round < 2; ++round)
+        {
+            next_band_ = round;
+            ThreadList thread_list;
+            BOOST_FOREACH(SocketStreamPtr worker, workers_)
+            {
+                thread_list.push_back(ThreadPtr(new boost::thread(&DistributedRenderer::run_jobs, this, worker.get())));
+            }
+            BOOST_FOREACH(ThreadPtr thread, thread_list)
+            {
+                thread->join();
+            }
+            if(not error_.empty())
+            {
+                throw std::runtime_error("Worker failed: " + error_);
+            }
+        }
+    }
+
+private:
+    void run_jobs(SocketStream* worker)
+    {
+        try
+        {
+            while(true)
+            {
+                RenderJob job = job_template_;
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    if(next_band_ >= bands_.size() or not error_.empty())
+                    {
+                        return;
+                    }
+                    job.first_row = bands_[next_band_].first;
+                    job.row_count = bands_[next_band_].second;
+                    next_band_ += 2;
+                }
+                add_fixed_stones(job);
+                job.write(*worker);
+                receive_band(*worker, job);
+                cout << "Rendered rows " << job.first_row << " to " << job.first_row + job.row_count - 1 << endl;
+            }
+        }
+        catch(std::exception& error)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            error_ = error.what();
+        }
+    }
+
+    void add_fixed_stones(RenderJob& job) const
+    {
+        int first = std::max<int>(0, job.first_row - render_settings_->min_distance);
+        int end = std::min<int>(stone_ids_.size(), job.first_row + job.row_count + render_settings_->min_distance);
+        for(int y = first; y < end; ++y)
+        {
+            for(size_t x = 0; x < stone_ids_[y].size(); ++x)
+            {
+                if(stone_ids_[y][x] != 0 and (y < job.first_row or y >= job.first_row + job.row_count))
+                {
+                    PlacedStone fixed_stone;
+                    fixed_stone.position = Position(x, y);
+                    fixed_stone.stone_id = stone_ids_[y][x];
+                    job.fixed_stones.push_back(fixed_stone);
+                }
+            }
+        }
+    }
+
+    void receive_band(SocketStream& worker, const RenderJob& job)
+    {
+        string status = worker.read_line();
+        if(status != "ok")
+        {
+            throw std::runtime_error(status);
+        }
+        std::stringstream ids(worker.read_line());
+        for(int y = job.first_row; y < job.first_row + job.row_count; ++y)
+        {
+            for(size_t x = 0; x < stone_ids_[y].size(); ++x)
+            {
+                ids >> stone_ids_[y][x];
+            }
+        }
+        std::stringstream size(worker.read_line());
+        ptrdiff_t width, height;
+        size >> width >> height;
+        if(not ids or not size or width != render_settings_->output_dimensions.x or height != job.row_count * render_settings_->output_stone_size.y)
+        {
+            throw std::runtime_error("Worker sent a malformed band.");
+        }
+        gil::rgb8_image_t band(width, height);
+        worker.read(reinterpret_cast<char*>(&view(band)(0, 0)), width * height * NUMBER_OF_CHANNELS);
+        output_image_->copy_rows(const_view(band), job.first_row * render_settings_->output_stone_size.y);
+    }
+
+    list<SocketStreamPtr> workers_;
+    vector<pair<int, int> > bands_;
+    vector<vector<int> > stone_ids_;
+    RenderJob job_template_;
+    const RenderSettings* render_settings_;
+    JPG* output_image_;
+    size_t next_band_;
+    string error_;
+    boost::mutex mutex_;
+};
+
+void render_distributed(const program_options::variables_map& input)
+{
+    if(input["checkpoint-interval"].as<int>() > 0 or input.count("resume"))
+    {
+        throw std::runtime_error("--checkpoint-interval and --resume cannot be used with --workers or --local-workers.");
+    }
+    if(input["time-budget"].as<double>() > 0)
+    {
+        throw std::runtime_error("--time-budget cannot be used with --workers or --local-workers.");
+    }
+    list<pid_t> worker_pids;
+    list<SocketStreamPtr> workers;
+    for(int i=0; i<input["local-workers"].as<int>(); ++i)
+    {
+        workers.push_back(spawn_local_worker(input, worker_pids));
+    }
+    if(input.count("workers"))
+    {
+        vector<string> hosts;
+        split(hosts, input["workers"].as<string>(), is_any_of(","));
+        BOOST_FOREACH(const string& host, hosts)
+        {
+            workers.push_back(connect_to_worker(host));
+        }
+    }
+
+    string source_img_path = input["picture-path"].as<string>();
+    Orientation orientation = orientation_from_image_path(source_img_path);
+    string database_filename = database_filename_from_input(input);
+    MosaicsDatabase mosaics_database(database_filename);
+    RenderSettings render_settings(
+            swap_dimensions_if(gil::jpeg_read_dimensions(source_img_path), orientation),
+            input["output-width"].as<int>(),
+            input["x-resolution-in-stones"].as<int>(),
+            input["min-distance"].as<int>(),
+            mosaics_database.aspect_ratio());
+
+    RenderJob job_template;
+    job_template.picture_path = filesystem::absolute(source_img_path).string();
+    job_template.stone_count = mosaics_database.stones().size();
+    job_template.database_checksum = mosaics_database.checksum();
+    job_template.output_width = input["output-width"].as<int>();
+    job_template.x_resolution_in_stones = input["x-resolution-in-stones"].as<int>();
+    job_template.min_distance = input["min-distance"].as<int>();
+
+    {
+        // Scoped so the renderer lets go of the worker connections before the workers are waited for.
+        JPG output_image(render_settings.output_dimensions);
+        DistributedRenderer distributed_renderer(workers);
+        distributed_renderer.render(job_template, render_settings, output_image);
+        output_image.write(input["output-filename"].as<string>());
+        if(input.count("layout-filename"))
+        {
+            MosaicLayout(distributed_renderer.stone_ids(), database_filename, mosaics_database, render_settings.min_distance)
+                .write(input["layout-filename"].as<string>());
+        }
+    }
+
+    workers.clear();
+    BOOST_FOREACH(pid_t pid, worker_pids)
+    {
+        waitpid(pid, NULL, 0);
+    }
+}
@@ -0,0 +1,329 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "image.h"
+#include "phomo_actions.h"
+
+#include <exiv2/image.hpp>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+#include <fcntl.h>
+#include <setjmp.h>
+
+Orientation orientation_from_image_path(const string& path)
+{
+    Exiv2::Image::AutoPtr exif_image = Exiv2::ImageFactory::open(path);
+    exif_image->readMetadata();
+    Exiv2::ExifData &exifData = exif_image->exifData();
+    if(exifData.empty())
+    {
+        return NOT_ROTATED;
+    }
+    switch (exifData["Exif.Image.Orientation"].toLong())
+    {
+    case 1:
+        return NOT_ROTATED;
+    case 3:
+        return ROTATED_180;
+    case 6:
+        return ROTATED_90CCW;
+    case 8:
+        return ROTATED_90CW;
+    default:
+        return NOT_ROTATED;
+    }
+
+}
+
+void swap(gil::point2<std::ptrdiff_t>& dimensions)
+{
+    std::ptrdiff_t help = dimensions.x;
+    dimensions.x = dimensions.y;
+    dimensions.y = help;
+}
+
+gil::point2<std::ptrdiff_t> aspect_ratio_cropped_dimensions(gil::point2<std::ptrdiff_t> dimensions, double aspect_ratio, Orientation orientation)
+{
+    if (orientation == ROTATED_90CCW or orientation == ROTATED_90CW)
+    {
+        swap(dimensions);
+    }
+    if(dimensions.x/aspect_ratio > dimensions.y)
+    {
+        dimensions.x = dimensions.y*aspect_ratio;
+    }
+    else
+    {
+        dimensions.y = dimensions.x/aspect_ratio;
+    }
+    return dimensions;
+}
+
+gil::point2<std::ptrdiff_t> aspect_ratio_cropped_dimensions(const string& current_path, double aspect_ratio, Orientation orientation)
+{
+    return aspect_ratio_cropped_dimensions(gil::jpeg_read_dimensions(current_path), aspect_ratio, orientation);
+}
+
+bool read_file_stamp(const string& path, FileStamp& stamp)
+{
+    struct stat status;
+    if(stat(path.c_str(), &status) != 0)
+    {
+        return false;
+    }
+    stamp.size = status.st_size;
+    stamp.modification_time = status.st_mtime;
+    return true;
+}
+
+boost::uint64_t content_checksum(const string& text, boost::uint64_t checksum)
+{
+    for(string::const_iterator c = text.begin(); c != text.end(); ++c)
+    {
+        checksum ^= static_cast<unsigned char>(*c);
+        checksum *= 1099511628211ull;
+    }
+    return checksum;
+}
+
+/// Part of the index of the raster cell a pixel falls in, or -1 if it is cropped away.
+int raster_cell_part(ptrdiff_t coordinate, ptrdiff_t raster_size, int count, int factor)
+{
+    return coordinate / raster_size < count ? coordinate / raster_size * factor : -1;
+}
+
+struct RasterRun
+{
+    ptrdiff_t begin;
+    ptrdiff_t length;
+    int cell_part;
+};
+
+void raster_values_from_image(const gil::rgb8c_view_t& source_view, Orientation orientation, const Dimensions& cropped_dimensions,
+        int col_count, int row_count, vector<int>& raster_values)
+{
+    assert(raster_values.size() == (size_t)(col_count*row_count*NUMBER_OF_CHANNELS));
+    ptrdiff_t raster_width = cropped_dimensions.x / col_count;
+    ptrdiff_t raster_height = cropped_dimensions.y / row_count;
+    if (raster_width == 0 or raster_height == 0)
+    {
+        throw std::runtime_error("Photo is too small for the raster resolution.");
+    }
+    ptrdiff_t width = source_view.width();
+    ptrdiff_t height = source_view.height();
+    bool rotated_90 = orientation == ROTATED_90CCW or orientation == ROTATED_90CW;
+    bool flipped_columns = orientation == ROTATED_180 or orientation == ROTATED_90CW;
+    bool flipped_rows = orientation == ROTATED_180 or orientation == ROTATED_90CCW;
+
+    vector<RasterRun> runs;
+    for (ptrdiff_t x = 0; x < width; ++x)
+    {
+        ptrdiff_t column = flipped_columns ? width - 1 - x : x;
+        int cell_part = rotated_90 ? raster_cell_part(column, raster_height, row_count, col_count) : raster_cell_part(column, raster_width, col_count, 1);
+        if (not runs.empty() and runs.back().cell_part == cell_part)
+        {
+            ++runs.back().length;
+        }
+        else
+        {
+            RasterRun run = { x, 1, cell_part };
+            runs.push_back(run);
+        }
+    }
+
+    ChannelSummer summer;
+    vector<boost::uint64_t> sums(col_count*row_count*NUMBER_OF_CHANNELS, 0);
+    for (ptrdiff_t y = 0; y < height; ++y)
+    {
+        ptrdiff_t row = flipped_rows ? height - 1 - y : y;
+        int row_cell_part = rotated_90 ? raster_cell_part(row, raster_width, col_count, 1) : raster_cell_part(row, raster_height, row_count, col_count);
+        if (row_cell_part == -1)
+        {
+            continue;
+        }
+        const unsigned char* pixels = reinterpret_cast<const unsigned char*>(&source_view(0, y));
+        BOOST_FOREACH(const RasterRun& run, runs)
+        {
+            if (run.cell_part != -1)
+            {
+                summer.add(pixels + run.begin*NUMBER_OF_CHANNELS, run.length, &sums[(row_cell_part + run.cell_part)*NUMBER_OF_CHANNELS]);
+            }
+        }
+    }
+
+    int cell_count = col_count*row_count;
+    for (int cell = 0; cell < cell_count; ++cell)
+    {
+        for (int channel = 0; channel < NUMBER_OF_CHANNELS; ++channel)
+        {
+            raster_values[cell + channel*cell_count] = sums[cell*NUMBER_OF_CHANNELS + channel] / (raster_width * raster_height);
+        }
+    }
+}
+
+#ifdef PHOMO_COUNT_ALLOCATIONS
+// Counted by the command line only, see allocation_counting.cpp.
+__thread long thread_allocation_count = 0;
+
+long allocation_count() { return thread_allocation_count; }
+#else
+long allocation_count() { return 0; }
+#endif
+
+Timer timer;
+
+double seconds_on_clock(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void prefetch_file(const string& path)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd != -1)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#endif
+}
+
+/// Lets libjpeg report an error by jumping back into read_jpeg_rows() instead of exiting.
+struct JpegErrorManager
+{
+    jpeg_error_mgr manager;
+    jmp_buf jump_buffer;
+    char message[JMSG_LENGTH_MAX];
+};
+
+extern "C" void jump_on_jpeg_error(j_common_ptr info)
+{
+    JpegErrorManager* errors = reinterpret_cast<JpegErrorManager*>(info->err);
+    (*info->err->format_message)(info, errors->message);
+    longjmp(errors->jump_buffer, 1);
+}
+
+/// Keeps the warnings of libjpeg about damaged photos, which it prints to stderr, to itself.
+extern "C" void ignore_jpeg_message(j_common_ptr)
+{
+}
+
+/// Owns an open JPEG file and its decompressor, which are released however decoding ends.
+class JpegDecompressor
+{
+public:
+    explicit JpegDecompressor(const string& path) :
+        file_(fopen(path.c_str(), "rb")), created_(false)
+    {
+        if(file_ == NULL)
+        {
+            throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+        }
+        info_.err = jpeg_std_error(&errors_.manager);
+        errors_.manager.error_exit = jump_on_jpeg_error;
+        errors_.manager.output_message = ignore_jpeg_message;
+    }
+
+    ~JpegDecompressor()
+    {
+        if(created_)
+        {
+            jpeg_destroy_decompress(&info_);
+        }
+        fclose(file_);
+    }
+
+    /// Like every call into libjpeg, only after setjmp() on jump_buffer().
+    void create()
+    {
+        jpeg_create_decompress(&info_);
+        created_ = true;
+        jpeg_stdio_src(&info_, file_);
+    }
+
+    jpeg_decompress_struct& info() { return info_; }
+
+    /// Where libjpeg jumps to on an error, which error_message() then describes.
+    jmp_buf& jump_buffer() { return errors_.jump_buffer; }
+
+    const char* error_message() const { return errors_.message; }
+
+private:
+    FILE* file_;
+    bool created_;
+    jpeg_decompress_struct info_;
+    JpegErrorManager errors_;
+};
+
+gil::rgb8_view_t read_jpeg_rows(const string& path, int scale_denominator, ptrdiff_t first_row, ptrdiff_t end_row, PixelBuffer& buffer)
+{
+    JpegDecompressor decompressor(path);
+    jpeg_decompress_struct& info = decompressor.info();
+    // Nothing that is changed after setjmp() is used after the jump back, which may have lost the change.
+    if(setjmp(decompressor.jump_buffer()))
+    {
+        throw std::runtime_error(path + ": " + decompressor.error_message());
+    }
+    decompressor.create();
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    info.scale_num = 1;
+    info.scale_denom = scale_denominator;
+    jpeg_start_decompress(&info);
+
+    ptrdiff_t rows_end = std::min(end_row, (ptrdiff_t)info.output_height);
+    ptrdiff_t rows_begin = std::min(first_row, rows_end);
+    gil::rgb8_view_t rows = buffer.view(Dimensions(info.output_width, rows_end - rows_begin));
+    while(info.output_scanline < rows_end)
+    {
+        // Rows above rows_begin are decoded into the first row and overwritten later.
+        JSAMPROW row = reinterpret_cast<JSAMPROW>(&rows(0, std::max((ptrdiff_t)0, (ptrdiff_t)info.output_scanline - rows_begin)));
+        jpeg_read_scanlines(&info, &row, 1);
+    }
+    return rows;
+}
+
+gil::rgb8_view_t read_stone_crop(const string& path, const StoneSource& source, Dimensions stone_size, PixelBuffer& buffer)
+{
+    pair<Position, Dimensions> crop = source.stored_crop();
+    if(source.orientation == ROTATED_90CCW or source.orientation == ROTATED_90CW)
+    {
+        swap(stone_size);
+    }
+    int scale = 8;
+    while(scale > 1 and (crop.second.x / scale < stone_size.x or crop.second.y / scale < stone_size.y))
+    {
+        scale /= 2;
+    }
+    // Rounded inwards, so that nothing outside the crop shows.
+    ptrdiff_t first_row = (crop.first.y + scale - 1) / scale;
+    ptrdiff_t first_column = (crop.first.x + scale - 1) / scale;
+    gil::rgb8_view_t rows = read_jpeg_rows(path, scale, first_row, (crop.first.y + crop.second.y) / scale, buffer);
+    ptrdiff_t end_column = std::min((crop.first.x + crop.second.x) / scale, rows.width());
+    if(rows.height() == 0 or end_column <= first_column)
+    {
+        throw std::runtime_error("The crop stored for " + path + " lies outside of the photo.");
+    }
+    return gil::subimage_view(rows, first_column, 0, end_column - first_column, rows.height());
+}
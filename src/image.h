@@ -0,0 +1,376 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Pixels, raster values and JPEG decoding, which the rest of the engine builds on. Like
+ * the other headers of the engine it is internal to libphomo and the command line, and
+ * it brings the names of the standard library and Boost into scope that all sources of
+ * the engine use unqualified.
+ */
+#ifndef PHOMO_IMAGE_H
+#define PHOMO_IMAGE_H
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <list>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <algorithm>
+#include <string>
+
+#include <boost/gil/image.hpp>
+#include <boost/gil/typedefs.hpp>
+
+#include <boost/gil/extension/io/jpeg_dynamic_io.hpp>
+#include <boost/gil/extension/numeric/sampler.hpp>
+#include <boost/gil/extension/numeric/resample.hpp>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/timer.hpp>
+#include <boost/foreach.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace gil = boost::gil;
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::map;
+using std::list;
+using std::endl;
+using std::ofstream;
+using std::ifstream;
+using std::vector;
+using std::ptrdiff_t;
+using std::pair;
+using boost::algorithm::iends_with;
+using boost::lexical_cast;
+using boost::algorithm::split;
+using boost::algorithm::is_any_of;
+
+const int NUMBER_OF_CHANNELS = 3;
+
+const int RED_CHANNEL_INDEX = 0;
+const int GREEN_CHANNEL_INDEX = 1;
+const int BLUE_CHANNEL_INDEX = 2;
+
+enum Orientation { NOT_ROTATED = 1, ROTATED_180 = 3, ROTATED_90CCW = 6, ROTATED_90CW = 8 };
+
+/**
+ * sums is a buffer for the sums of the cells, which are 64 bits wide, so that cells of
+ * any size fit. It is passed in so that it can be reused for every tile.
+ */
+template<class View>
+void raster_values_from_view(const View& source_view, int col_count, int row_count, vector<int>& raster_values,
+        vector<boost::uint64_t>& sums)
+{
+    assert(raster_values.size() == (size_t)(col_count*row_count*NUMBER_OF_CHANNELS));
+    typename View::x_coord_t raster_width = source_view.width() / col_count;
+    typename View::y_coord_t raster_height = source_view.height() / row_count;
+    int cell_count = col_count*row_count;
+
+    // All channels of all cells are summed up in a single pass over the rows of the view.
+    sums.assign(raster_values.size(), 0);
+    for (int y = 0; y < row_count*raster_height; ++y)
+    {
+        typename View::x_iterator pixel = source_view.row_begin(y);
+        boost::uint64_t* cell = &sums[(y / raster_height) * col_count];
+        for (int x = 0; x < col_count; ++x, ++cell)
+        {
+            for (int i = 0; i < raster_width; ++i, ++pixel)
+            {
+                cell[RED_CHANNEL_INDEX*cell_count] += gil::semantic_at_c<RED_CHANNEL_INDEX>(*pixel);
+                cell[GREEN_CHANNEL_INDEX*cell_count] += gil::semantic_at_c<GREEN_CHANNEL_INDEX>(*pixel);
+                cell[BLUE_CHANNEL_INDEX*cell_count] += gil::semantic_at_c<BLUE_CHANNEL_INDEX>(*pixel);
+            }
+        }
+    }
+    for (size_t i = 0; i < raster_values.size(); ++i)
+    {
+        raster_values[i] = sums[i] / (raster_width * raster_height);
+    }
+}
+
+/**
+ * Adds up the red, green and blue values of runs of contiguous rgb8 pixels.
+ */
+class ChannelSummer
+{
+public:
+    ChannelSummer()
+    {
+#ifdef __SSE2__
+        // 16 pixels fill three registers, in each of which the channels repeat every three bytes.
+        for (int word = 0; word < 3; ++word)
+        {
+            for (int channel = 0; channel < NUMBER_OF_CHANNELS; ++channel)
+            {
+                unsigned char mask[16];
+                for (int byte = 0; byte < 16; ++byte)
+                {
+                    mask[byte] = (16*word + byte) % NUMBER_OF_CHANNELS == channel ? 0xff : 0;
+                }
+                masks_[word][channel] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+            }
+        }
+#endif
+    }
+
+    void add(const unsigned char* pixels, ptrdiff_t count, boost::uint64_t* sums) const
+    {
+        ptrdiff_t i = 0;
+#ifdef __SSE2__
+        // Masking out all but one channel and summing the absolute differences to zero
+        // widens and adds up the bytes of that channel.
+        if (count >= 16)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i accumulators[NUMBER_OF_CHANNELS] = { zero, zero, zero };
+            for (; i + 16 <= count; i += 16)
+            {
+                const __m128i* words = reinterpret_cast<const __m128i*>(pixels + i*NUMBER_OF_CHANNELS);
+                for (int word = 0; word < 3; ++word)
+                {
+                    __m128i values = _mm_loadu_si128(words + word);
+                    for (int channel = 0; channel < NUMBER_OF_CHANNELS; ++channel)
+                    {
+                        accumulators[channel] = _mm_add_epi64(accumulators[channel],
+                                _mm_sad_epu8(_mm_and_si128(values, masks_[word][channel]), zero));
+                    }
+                }
+            }
+            for (int channel = 0; channel < NUMBER_OF_CHANNELS; ++channel)
+            {
+                boost::uint64_t halves[2];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(halves), accumulators[channel]);
+                sums[channel] += halves[0] + halves[1];
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            sums[RED_CHANNEL_INDEX] += pixels[i*NUMBER_OF_CHANNELS + RED_CHANNEL_INDEX];
+            sums[GREEN_CHANNEL_INDEX] += pixels[i*NUMBER_OF_CHANNELS + GREEN_CHANNEL_INDEX];
+            sums[BLUE_CHANNEL_INDEX] += pixels[i*NUMBER_OF_CHANNELS + BLUE_CHANNEL_INDEX];
+        }
+    }
+
+private:
+#ifdef __SSE2__
+    __m128i masks_[3][NUMBER_OF_CHANNELS];
+#endif
+};
+
+Orientation orientation_from_image_path(const string& path);
+
+typedef gil::point2<std::ptrdiff_t> Dimensions;
+typedef gil::point2<std::ptrdiff_t> Position;
+
+void swap(gil::point2<std::ptrdiff_t>& dimensions);
+
+gil::point2<std::ptrdiff_t> aspect_ratio_cropped_dimensions(gil::point2<std::ptrdiff_t> dimensions, double aspect_ratio, Orientation orientation);
+
+gil::point2<std::ptrdiff_t> aspect_ratio_cropped_dimensions(const string& current_path, double aspect_ratio, Orientation orientation);
+
+/// Size and modification time of a photo, to notice that it changed after it was indexed.
+struct FileStamp
+{
+    boost::uint64_t size;
+    time_t modification_time;
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size and modification_time == other.modification_time;
+    }
+};
+
+/// Returns false if path cannot be stat'ed.
+bool read_file_stamp(const string& path, FileStamp& stamp);
+
+const boost::uint64_t EMPTY_CHECKSUM = 14695981039346656037ull;
+
+/// Continues checksum, a 64 bit FNV-1a hash of everything passed before, with text.
+boost::uint64_t content_checksum(const string& text, boost::uint64_t checksum = EMPTY_CHECKSUM);
+
+/**
+ * What build-database found out about the photo of a stone: its orientation, its
+ * dimensions as stored, and the crop that matches the aspect ratio of the database in
+ * the coordinates of the oriented photo. Render decodes just the crop without probing
+ * the photo again, as long as the file still has the same stamp.
+ */
+struct StoneSource
+{
+    Orientation orientation;
+    Dimensions photo_dimensions;
+    Position crop_position;
+    Dimensions crop_dimensions;
+    FileStamp stamp;
+
+    static const size_t FIELD_COUNT = 9;
+
+    bool is_current(const string& path) const
+    {
+        FileStamp current;
+        return read_file_stamp(path, current) and current == stamp;
+    }
+
+    /// The crop in the coordinates of the photo as stored, before it is oriented.
+    pair<Position, Dimensions> stored_crop() const
+    {
+        const Position& p = crop_position;
+        const Dimensions& d = crop_dimensions;
+        ptrdiff_t width = photo_dimensions.x;
+        ptrdiff_t height = photo_dimensions.y;
+        switch(orientation)
+        {
+        case ROTATED_180:
+            return pair<Position, Dimensions>(Position(width - p.x - d.x, height - p.y - d.y), d);
+        case ROTATED_90CCW:
+            return pair<Position, Dimensions>(Position(p.y, height - p.x - d.x), Dimensions(d.y, d.x));
+        case ROTATED_90CW:
+            return pair<Position, Dimensions>(Position(width - p.y - d.y, p.x), Dimensions(d.y, d.x));
+        default:
+            return pair<Position, Dimensions>(p, d);
+        }
+    }
+
+    /// Appends the fields to a database line.
+    void write(std::ostream& output) const
+    {
+        output << "|" << orientation << "|" << photo_dimensions.x << "|" << photo_dimensions.y
+               << "|" << crop_position.x << "|" << crop_position.y << "|" << crop_dimensions.x << "|" << crop_dimensions.y
+               << "|" << stamp.size << "|" << stamp.modification_time;
+    }
+
+    /// Reads the fields of a database line, starting at parts[first].
+    void read(const vector<string>& parts, size_t first)
+    {
+        int orientation_value = lexical_cast<int>(parts[first]);
+        if(orientation_value != NOT_ROTATED and orientation_value != ROTATED_180 and orientation_value != ROTATED_90CCW and orientation_value != ROTATED_90CW)
+        {
+            throw std::runtime_error("Unknown orientation " + parts[first] + ".");
+        }
+        orientation = static_cast<Orientation>(orientation_value);
+        photo_dimensions = Dimensions(lexical_cast<ptrdiff_t>(parts[first + 1]), lexical_cast<ptrdiff_t>(parts[first + 2]));
+        crop_position = Position(lexical_cast<ptrdiff_t>(parts[first + 3]), lexical_cast<ptrdiff_t>(parts[first + 4]));
+        crop_dimensions = Dimensions(lexical_cast<ptrdiff_t>(parts[first + 5]), lexical_cast<ptrdiff_t>(parts[first + 6]));
+        stamp.size = lexical_cast<boost::uint64_t>(parts[first + 7]);
+        stamp.modification_time = lexical_cast<time_t>(parts[first + 8]);
+    }
+};
+
+/**
+ * Computes the same raster values as raster_values_from_view() on the oriented view of
+ * an rgb8 image cropped to cropped_dimensions, in a single pass over the rows of the
+ * unrotated image. Instead of rotating the view, every source column and row is mapped
+ * to the part of the index of the raster cell it falls in that it determines. Each row
+ * then consists of runs of pixels that belong to the same cell.
+ */
+void raster_values_from_image(const gil::rgb8c_view_t& source_view, Orientation orientation, const Dimensions& cropped_dimensions,
+        int col_count, int row_count, vector<int>& raster_values);
+
+/// The allocations of the calling thread so far, always 0 unless built with PHOMO_COUNT_ALLOCATIONS.
+long allocation_count();
+
+class Timer
+{
+    boost::timer timer_;
+public:
+    void restart() {
+#ifdef PHOMO_TIMER
+        timer_.restart();
+#endif
+    }
+    // Not a string, which would be allocated for every call even with PHOMO_TIMER undefined.
+    void print_elapsed_with_label(const char* label)
+    {
+#ifdef PHOMO_TIMER
+        cout << label << ": " << timer_.elapsed() << "seconds" << endl;
+#endif
+    }
+};
+
+extern Timer timer;
+
+double seconds_on_clock(clockid_t clock);
+
+/**
+ * Tells the kernel that a file is going to be read soon, so that its pages are
+ * already in the cache when a render thread needs them.
+ */
+void prefetch_file(const string& path);
+
+/**
+ * Memory for the pixels of one image at a time, which only ever grows. A render thread
+ * keeps one for decoding stone photos and one for scaling them down, so that it stops
+ * allocating after its first few stones.
+ */
+class PixelBuffer
+{
+    vector<gil::rgb8_pixel_t> pixels_;
+public:
+    gil::rgb8_view_t view(const Dimensions& dimensions)
+    {
+        size_t size = dimensions.x * dimensions.y;
+        if(pixels_.size() < size)
+        {
+            pixels_.resize(size);
+        }
+        return gil::interleaved_view(dimensions.x, dimensions.y, &pixels_[0], dimensions.x * sizeof(gil::rgb8_pixel_t));
+    }
+};
+
+/**
+ * Decodes the rows first_row up to end_row of a JPEG scaled down by 1/scale_denominator,
+ * which libjpeg does inside the inverse DCT for 1, 2, 4 and 8. Rows are in scaled
+ * coordinates, and decoding stops after the last row that is needed.
+ */
+gil::rgb8_view_t read_jpeg_rows(const string& path, int scale_denominator, ptrdiff_t first_row, ptrdiff_t end_row, PixelBuffer& buffer);
+
+/**
+ * Decodes the crop of the photo of a stone, in the coordinates of the photo as stored,
+ * at the smallest scale that still gives the crop at least the pixels of stone_size.
+ */
+gil::rgb8_view_t read_stone_crop(const string& path, const StoneSource& source, Dimensions stone_size, PixelBuffer& buffer);
+
+#endif
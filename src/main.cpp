@@ -0,0 +1,249 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "phomo_actions.h"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+namespace program_options = boost::program_options;
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::vector;
+
+program_options::options_description visible_options_description()
+{
+    program_options::options_description options_description;
+
+    options_description.add_options()
+        ("help,h", "Prints this help.")
+        ("version,v", "Prints version information.");
+    program_options::options_description shared_options("Options shared between build-database and render");
+    shared_options.add_options()
+        ("database-filename", program_options::value<string>(), "The filename for the photos database, or for the manifest of its variants.")
+        ("resume", "Continue an interrupted run. build-database keeps the stones already in the database and skips their photos. "
+                   "render continues from the last checkpoint.");
+    program_options::options_description build_database_options("Options allowed for build-database");
+    build_database_options.add_options()
+        ("input-type", program_options::value<string>(), "Specifies the input type. Allowed values: directory | file.")
+        ("photos-dir", program_options::value<string>(), "Top-directory which will be recursively traversed to build mosaic stones database.")
+        ("discovery-threads", program_options::value<int>()->default_value(4), "Number of threads that traverse photos-dir in parallel.")
+        ("photos-file", program_options::value<string>(), "File that contains a list of image file paths to be used as mosaic stones. A \"-\" uses standard input instead of a file.")
+        ("aspect-ratio", program_options::value<string>()->default_value("1"), "Aspect ratio which should be used for the mosaic stones. Either WidthxHeight or a real number. "
+                                                                               "A comma separated list builds a database variant for each, from a single decode of every photo. "
+                                                                               "render picks the variant with this aspect ratio.")
+        ("raster-resolution", program_options::value<string>()->default_value("3"), "Resolution of the rasterization the algorithm should internally use. "
+                                                                                   "Like aspect-ratio, it can be a list for build-database and picks the variant for render.")
+        ("shard-count", program_options::value<int>()->default_value(1), "Number of shards the photos are split into. Every path is assigned to a shard by a hash of the path.")
+        ("shard-index", program_options::value<int>()->default_value(0), "Index of the shard this run indexes. Must be smaller than shard-count.")
+        ("index-lists", program_options::value<int>()->default_value(0), "Number of lists of the approximate search index stored next to the database. 0 builds no index.")
+        ("atlas-tile-widths", program_options::value<string>()->default_value(""), "Comma separated pixel widths of the tiles of the atlas stored next to the database, e.g. 64,256. "
+                                                                                  "render takes its stones from the atlas instead of the original photos. Empty builds no atlas.");
+    program_options::options_description merge_database_options("Options allowed for merge-database");
+    merge_database_options.add_options()
+        ("input-database", program_options::value<vector<string> >()->composing(), "A database to merge. Can be given multiple times.");
+    program_options::options_description compact_database_options("Options allowed for compact-database");
+    compact_database_options.add_options()
+        ("output-database-filename", program_options::value<string>(), "The filename for the resulting photos database. For compact-database it may be the same as database-filename.")
+        ("duplicate-threshold", program_options::value<int>()->default_value(4), "Maximum root mean square difference per raster value for two stones to be considered near-duplicates.")
+        ("confirm-with-perceptual-hash", "Only treat stones as near-duplicates if their perceptual hashes are similar too. Requires access to the photos.")
+        ("max-perceptual-hash-distance", program_options::value<int>()->default_value(6), "Maximum number of differing bits for two perceptual hashes to be considered similar.");
+    program_options::options_description render_options("Options allowed for render");
+    render_options.add_options()
+        ("picture-path", program_options::value<string>(), "Path of the input pictures that is to be mosaicized.")
+        ("output-width", program_options::value<int>()->default_value(1024), "Pixel resolution of the resulting photo mosaic.")
+        ("x-resolution-in-stones", program_options::value<int>()->default_value(10), "Resolution of the resulting photo mosaic measured in mosaic stones.")
+        ("min-distance", program_options::value<int>()->default_value(10), "The minimum distance in which identical stones are allowed to appear.")
+        ("number-of-threads", program_options::value<int>()->default_value(4), "Fine tune control over number of threads to use.")
+        ("print-time-left", "Print time left to complete instead of progress in percentage.")
+        ("search-probes", program_options::value<int>()->default_value(0), "Number of index lists searched for every stone. More lists give better matches but take longer. 0 searches the whole database exactly.")
+        ("ignore-atlas", "Always read the original photos, even if the database has a tile atlas.")
+        ("benchmark-recall", "Also run the exact search for every stone and report the recall of the approximate search.")
+        ("local-workers", program_options::value<int>()->default_value(0), "Number of worker processes on this machine the mosaic is distributed to.")
+        ("workers", program_options::value<string>(), "Comma separated host:port list of render-worker processes the mosaic is distributed to. "
+                                                      "They need the same database and access to the same photo paths.")
+        ("listen-port", program_options::value<int>()->default_value(7070), "Port render-worker waits for coordinators on.")
+        ("listen-address", program_options::value<string>()->default_value("127.0.0.1"), "IPv4 address render-worker waits for coordinators on. "
+                                                                                      "Workers read any photo a coordinator asks for, so only listen on other "
+                                                                                      "addresses than this machine's on trusted networks.")
+        ("checkpoint-interval", program_options::value<int>()->default_value(0), "Seconds between checkpoints that allow to resume an interrupted render. 0 disables checkpoints.")
+        ("candidates-per-tile", program_options::value<int>()->default_value(0), "Number of closest stones found for every tile, in parallel, before any stone is placed. "
+                                                                               "Placing a stone then only searches its tile's list, unless min-distance excludes all of them, "
+                                                                               "which never happens with (2*min-distance+1)^2 stones. 0 searches the database for every tile.")
+        ("prefetch-window", program_options::value<int>()->default_value(16), "Number of matched stone photos per thread that are read ahead of compositing. 0 disables read-ahead.")
+        ("layout-filename", program_options::value<string>(), "File the stone matched to every position is saved to by render and read from by render-layout.")
+        ("time-budget", program_options::value<double>()->default_value(0), "Seconds render may take, counted from its start. Tiles that would not be ready in time are "
+                                                                           "matched against part of the database, composited at low resolution or filled with the raster "
+                                                                           "cells of their stone. 0 disables the budget. Only render without workers has one.")
+        ("degraded-tiles-filename", program_options::value<string>(), "File the positions of the tiles the time budget degraded are written to, with the stages they fell back to.")
+        ("output-filename", program_options::value<string>(), "Image file path for the resulting photo mosaic.");
+    options_description.add(shared_options);
+    options_description.add(build_database_options);
+    options_description.add(compact_database_options);
+    options_description.add(merge_database_options);
+    options_description.add(render_options);
+    return options_description;
+}
+
+program_options::options_description full_options_description()
+{
+    program_options::options_description action;
+
+    action.add_options()
+        ("action", program_options::value<string>(), "Allowed values: build-database | build-index | build-atlas | compact-database | merge-database | render | render-layout | render-worker.\n"
+                                                     "build-database will build up a database of mosaic stones to use.\n"
+                                                     "build-index will build the approximate search index for an existing database.\n"
+                                                     "build-atlas will build the tile atlas for an existing database.\n"
+                                                     "compact-database will remove near-duplicate stones from an existing database.\n"
+                                                     "merge-database will combine databases built as separate shards.\n"
+                                                     "render will use an existing mosaic stones database to render a picture.\n"
+                                                     "render-layout will render a mosaic saved by render again, at another output size.\n"
+                                                     "render-worker will render parts of pictures for render running on other machines.");
+    action.add(visible_options_description());
+    return action;
+
+}
+
+program_options::variables_map parse_command_line(int argc, char** argv)
+{
+    program_options::options_description options_description = full_options_description();
+
+    program_options::positional_options_description pos_options_desc;
+    pos_options_desc.add("action", 1);
+
+    program_options::variables_map result;
+    program_options::store(program_options::command_line_parser(argc, argv).options(options_description).positional(
+            pos_options_desc).run(), result);
+    program_options::notify(result);
+    return result;
+}
+
+string help()
+{
+    std::stringstream output;
+    output << "USAGE: " << endl
+        << "phomo build-database <build-databse-options>" << endl
+        << "phomo build-index --database-filename <filename> --index-lists <count>" << endl
+        << "phomo build-atlas --database-filename <filename> --atlas-tile-widths <width>,..." << endl
+        << "phomo compact-database <compact-database-options>" << endl
+        << "phomo merge-database <merge-database-options>" << endl
+        << "phomo render <render-options>" << endl
+        << "phomo render-layout --layout-filename <filename> --output-width <width> --output-filename <filename>" << endl
+        << "phomo render-worker --database-filename <filename> [--listen-address <address>] --listen-port <port>" << endl
+        << "phomo -h | -v\n\n"
+     << visible_options_description();
+    return output.str();
+}
+
+string version()
+{
+    return "phomo " VERSION;
+}
+
+void run(const program_options::variables_map& input)
+{
+    if(input.count("help"))
+    {
+        cout << help() << endl;
+    }
+    else if (input.count("version"))
+    {
+        cout << version() << endl;
+    }
+    else if (input.count("action"))
+    {
+        if (input["action"].as<string> () == "build-database")
+        {
+            build_database_from_input(input);
+        }
+        else if (input["action"].as<string> () == "build-atlas")
+        {
+            build_atlas_from_input(input);
+        }
+        else if (input["action"].as<string> () == "build-index")
+        {
+            build_index_from_input(input);
+        }
+        else if (input["action"].as<string> () == "merge-database" and not input.count("output-database-filename"))
+        {
+            cerr << "merge-database needs --output-database-filename." << endl;
+            cout << help() << endl;
+        }
+        else if (input["action"].as<string> () == "merge-database")
+        {
+            merge_database_from_input(input);
+        }
+        else if (input["action"].as<string> () == "compact-database" and not input.count("output-database-filename"))
+        {
+            cerr << "compact-database needs --output-database-filename." << endl;
+            cout << help() << endl;
+        }
+        else if (input["action"].as<string> () == "compact-database")
+        {
+            compact_database_from_input(input);
+        }
+        else if (input["action"].as<string> () == "render-layout")
+        {
+            render_layout(input);
+        }
+        else if (input["action"].as<string> () == "render-worker")
+        {
+            run_render_worker(input);
+        }
+        else if (input["action"].as<string> () == "render" and (input.count("workers") or input["local-workers"].as<int>() > 0))
+        {
+            render_distributed(input);
+        }
+        else if (input["action"].as<string> () == "render")
+        {
+            render_picture(input);
+        }
+        else
+        {
+            cerr << "No action was specified." << endl;
+            cout << help() << endl;
+        }
+    }
+    else
+    {
+        cerr << "No action was specified." << endl;
+        cout << help() << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        run(parse_command_line(argc, argv));
+        return 0;
+    }
+    catch(std::exception& error)
+    {
+        cerr << "Error: " << error.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * C interface of libphomo, for programs that render mosaics in-process. A database is
+ * opened once and can then render any number of pictures, also at the same time from
+ * several threads. Pictures are passed and returned as interleaved 8 bit RGB pixels in
+ * buffers owned by the caller.
+ */
+#ifndef PHOMO_H
+#define PHOMO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* libphomo is built with hidden symbols, only these functions are exported. */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define PHOMO_API __attribute__((visibility("default")))
+#else
+#define PHOMO_API
+#endif
+
+#define PHOMO_OK 0
+#define PHOMO_ERROR -1
+#define PHOMO_CANCELLED 1
+
+typedef struct phomo_database phomo_database;
+
+/*
+ * Called after every composited stone with the share of the mosaic done so far. Never
+ * called by two threads at the same time. Returning nonzero cancels the render.
+ */
+typedef int (*phomo_progress_callback)(double done, void* user_data);
+
+typedef struct phomo_render_settings
+{
+    int x_resolution_in_stones;
+    int output_width;
+    int min_distance;
+    int number_of_threads;
+    /* Matched stone photos per thread that are read ahead of compositing. */
+    int prefetch_window;
+    /* Index lists searched for every stone. 0 searches the whole database exactly. */
+    int search_probes;
+    /* Closest stones found for every tile before any stone is placed. 0 disables the lists. */
+    int candidates_per_tile;
+    /* Nonzero takes stones from the tile atlas of the database, if it has one. */
+    int use_atlas;
+    /* Seconds the render may take. 0 disables the budget. */
+    double time_budget;
+} phomo_render_settings;
+
+/* The same defaults as the command line. */
+PHOMO_API void phomo_default_render_settings(phomo_render_settings* settings);
+
+/* Returns NULL if the database cannot be opened, see phomo_last_error(). */
+PHOMO_API phomo_database* phomo_open_database(const char* filename);
+
+PHOMO_API void phomo_close_database(phomo_database* database);
+
+/* The size of the mosaic phomo_render() makes of a picture of the given size. */
+PHOMO_API int phomo_output_dimensions(const phomo_database* database, const phomo_render_settings* settings,
+        int picture_width, int picture_height, int* output_width, int* output_height);
+
+/*
+ * Renders the picture into output, which must have the size phomo_output_dimensions()
+ * returns. Strides are in bytes. progress may be NULL. Returns PHOMO_OK, PHOMO_CANCELLED
+ * or PHOMO_ERROR. A cancelled render leaves the tiles it did not get to as they were.
+ */
+PHOMO_API int phomo_render(phomo_database* database, const phomo_render_settings* settings,
+        const unsigned char* picture, int picture_width, int picture_height, int picture_stride,
+        unsigned char* output, int output_stride, phomo_progress_callback progress, void* user_data);
+
+/* The message of the last error of the calling thread. */
+PHOMO_API const char* phomo_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
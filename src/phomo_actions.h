@@ -0,0 +1,53 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * The actions of the phomo command line, which main.cpp dispatches to after parsing
+ * the options. They are not part of libphomo, whose interface is phomo.h, but built
+ * into the command line next to the engine it links in statically. Errors are thrown
+ * as std::exception.
+ */
+#ifndef PHOMO_ACTIONS_H
+#define PHOMO_ACTIONS_H
+
+#include <boost/program_options/variables_map.hpp>
+
+void build_database_from_input(const boost::program_options::variables_map& input);
+
+void build_index_from_input(const boost::program_options::variables_map& input);
+
+void build_atlas_from_input(const boost::program_options::variables_map& input);
+
+void merge_database_from_input(const boost::program_options::variables_map& input);
+
+void compact_database_from_input(const boost::program_options::variables_map& input);
+
+void render_picture(const boost::program_options::variables_map& input);
+
+void render_distributed(const boost::program_options::variables_map& input);
+
+void render_layout(const boost::program_options::variables_map& input);
+
+void run_render_worker(const boost::program_options::variables_map& input);
+
+#ifdef PHOMO_COUNT_ALLOCATIONS
+/// The allocations of the calling thread, counted by the operator new of allocation_counting.cpp.
+extern __thread long thread_allocation_count;
+#endif
+
+#endif
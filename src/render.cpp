@@ -0,0 +1,124 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "render.h"
+
+const size_t RenderStatistics::MAX_STONE_ERROR_MESSAGES;
+
+int start_from_coord_and_min_dinstance(int coord, int min_distance)
+{
+    int result = coord - min_distance;
+    if (result<0)
+    {
+        result = 0;
+    }
+    return result;
+}
+
+int end_from_coord_and_min_distance(int coord, int min_distance, int resolution)
+{
+    int end = coord+min_distance;
+    if (end > resolution-1)
+    {
+        end=resolution-1;
+    }
+    return end;
+}
+
+void collect_distance_caused_excludes(const Position& pos, const OutputMatrix& output, int min_distance, vector<const MosaicStone*>& excludes)
+{
+    int startx = start_from_coord_and_min_dinstance(pos.x, min_distance);
+    int starty = start_from_coord_and_min_dinstance(pos.y, min_distance);
+    int endx = end_from_coord_and_min_distance(pos.x, min_distance, output.xres());
+    int endy = end_from_coord_and_min_distance(pos.y, min_distance, output.yres());
+    excludes.clear();
+    for(int i=startx; i<=endx; ++i)
+    {
+        for(int j=starty; j<=endy; ++j)
+        {
+            const MosaicStone* stone = output(i,j);
+            if((i!=pos.x or j!=pos.y) and stone != NULL)
+            {
+                excludes.push_back(stone);
+            }
+        }
+    }
+}
+
+void collect_warm_start_candidates(const Position& pos, const OutputMatrix& output, int min_distance, vector<const MosaicStone*>& candidates)
+{
+    const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    candidates.clear();
+    for(int i=0; i<4; ++i)
+    {
+        int x = pos.x + offsets[i][0] * (min_distance + 1);
+        int y = pos.y + offsets[i][1] * (min_distance + 1);
+        if(x >= 0 and x < output.xres() and y >= 0 and y < output.yres() and output(x, y))
+        {
+            candidates.push_back(output(x, y));
+        }
+    }
+}
+
+void write_checkpoints(const RenderCheckpoint* checkpoint, const OutputMatrix* output, JPG* output_image)
+{
+    try
+    {
+        while(true)
+        {
+            boost::this_thread::sleep(boost::posix_time::seconds(checkpoint->interval_seconds()));
+            output_image->sync();
+            try
+            {
+                checkpoint->save(*output);
+            }
+            catch(std::exception& error)
+            {
+                cerr << "Error writing checkpoint: " << error.what() << " ==> trying again later" << endl;
+            }
+        }
+    }
+    catch(boost::thread_interrupted&)
+    {
+    }
+}
+
+int ignore_progress(double, void*)
+{
+    return 0;
+}
+
+const int PlacedStone::NO_STONE;
+
+const string MosaicLayout::LAYOUT_HEADER = "phomo-layout 2";
+
+const double TimeBudget::JPEG_SECONDS_PER_PIXEL = 2e-8;
+
+Shuffler::~Shuffler() {}
+
+Dimensions swap_dimensions_if(const Dimensions& dimensions, Orientation orientation)
+{
+    if (orientation == NOT_ROTATED || orientation == ROTATED_180)
+    {
+        return dimensions;
+    }
+    else
+    {
+        return Dimensions(dimensions.y, dimensions.x);
+    }
+}
@@ -0,0 +1,1455 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Renders a picture into a mosaic: the output image and grid, checkpoints, layouts,
+ * the time budget, and the threads that search and composite the tiles.
+ */
+#ifndef PHOMO_RENDER_H
+#define PHOMO_RENDER_H
+
+#include "phomo.h"
+#include "atlas.h"
+#include "search.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+class RenderStatistics
+{
+    mutable boost::mutex mutex_;
+    int stones_loaded_;
+    int stones_probed_;
+    int atlas_tiles_;
+    double loading_seconds_;
+    double blocked_seconds_;
+    long tiles_;
+    long tiles_allocating_;
+    long allocations_;
+    long candidate_list_lookups_;
+    long candidate_list_fallbacks_;
+    long candidate_lists_missing_;
+    int candidates_per_tile_;
+    long candidate_list_tiles_;
+    double candidate_list_seconds_;
+    long stone_errors_;
+    // Only the first few, a database of moved photos would fail for every stone.
+    vector<string> stone_error_messages_;
+    static const size_t MAX_STONE_ERROR_MESSAGES = 10;
+public:
+    RenderStatistics() : stones_loaded_(0), stones_probed_(0), atlas_tiles_(0), loading_seconds_(0), blocked_seconds_(0),
+        tiles_(0), tiles_allocating_(0), allocations_(0), candidate_list_lookups_(0), candidate_list_fallbacks_(0),
+        candidate_lists_missing_(0), candidates_per_tile_(0), candidate_list_tiles_(0), candidate_list_seconds_(0), stone_errors_(0) {}
+
+    void add_candidate_lists(int candidates_per_tile, long tiles, double seconds)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        candidates_per_tile_ = candidates_per_tile;
+        candidate_list_tiles_ += tiles;
+        candidate_list_seconds_ += seconds;
+    }
+
+    void add_candidate_list_lookups(long lookups, long fallbacks, long missing_lists)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        candidate_list_lookups_ += lookups;
+        candidate_list_fallbacks_ += fallbacks;
+        candidate_lists_missing_ += missing_lists;
+    }
+
+    /// Only counts with PHOMO_COUNT_ALLOCATIONS defined.
+    void add_tile_allocations(long allocations)
+    {
+#ifdef PHOMO_COUNT_ALLOCATIONS
+        boost::mutex::scoped_lock lock(mutex_);
+        ++tiles_;
+        tiles_allocating_ += allocations > 0 ? 1 : 0;
+        allocations_ += allocations;
+#endif
+    }
+
+    void add_probed_stone()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++stones_probed_;
+    }
+
+    /// A stone whose photo could not be composited, which leaves its tile as it was.
+    void add_stone_error(const string& message)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++stone_errors_;
+        if(stone_error_messages_.size() < MAX_STONE_ERROR_MESSAGES)
+        {
+            stone_error_messages_.push_back(message);
+        }
+    }
+
+    void add_atlas_tile()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++atlas_tiles_;
+    }
+
+    /// Time a thread was not running on a CPU while loading is time it waited for I/O.
+    void add_stone_load(double wall_seconds, double cpu_seconds)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++stones_loaded_;
+        loading_seconds_ += wall_seconds;
+        blocked_seconds_ += std::max(0.0, wall_seconds - cpu_seconds);
+    }
+
+    void print(std::ostream& output) const
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        if(stones_loaded_ > 0 or atlas_tiles_ == 0)
+        {
+            output << "Loaded " << stones_loaded_ << " stone photos in " << loading_seconds_ << " seconds, "
+                   << blocked_seconds_ << " seconds of it blocked on I/O (summed over all threads)." << endl;
+        }
+        if(stones_probed_ > 0)
+        {
+            output << stones_probed_ << " stone photos were probed for orientation and size, because the database had no crop for them "
+                   << "or they had changed since build-database." << endl;
+        }
+        if(atlas_tiles_ > 0)
+        {
+            output << "Took " << atlas_tiles_ << " stones from the tile atlas." << endl;
+        }
+        if(candidate_list_tiles_ > 0)
+        {
+            output << "Found the " << candidates_per_tile_ << " closest stones of " << candidate_list_tiles_ << " tiles in "
+                   << candidate_list_seconds_ << " seconds." << endl;
+        }
+        if(candidate_list_lookups_ > 0)
+        {
+            output << candidate_list_fallbacks_ << " of " << candidate_list_lookups_ << " tiles ("
+                   << 100.0 * candidate_list_fallbacks_ / candidate_list_lookups_
+                   << "%) had all their candidates excluded and fell back to a full search." << endl;
+        }
+        if(candidate_lists_missing_ > 0)
+        {
+            output << candidate_lists_missing_ << " tiles had no candidate list and were searched in full." << endl;
+        }
+        if(tiles_ > 0)
+        {
+            output << "Allocated memory " << (double)allocations_ / tiles_ << " times per tile on average, "
+                   << tiles_allocating_ << " of " << tiles_ << " tiles allocated at all." << endl;
+        }
+        if(stone_errors_ > 0)
+        {
+            output << stone_errors_ << " stones could not be set and were left empty:" << endl;
+            BOOST_FOREACH(const string& message, stone_error_messages_)
+            {
+                output << "Error setting mosaic stone: " << message << endl;
+            }
+        }
+    }
+};
+
+class JPG
+{
+public:
+    JPG(const Dimensions& dimensions) :
+        image_(dimensions), mapped_pixels_(NULL), mapped_size_(0)
+    {
+       view_ = view(image_);
+    }
+
+    /// Composites into pixels owned by somebody else.
+    explicit JPG(const gil::rgb8_view_t& pixels) :
+        view_(pixels), mapped_pixels_(NULL), mapped_size_(0)
+    {}
+
+    /**
+     * Keeps the pixels in a memory-mapped file, so that they survive a crash of the
+     * process. With keep_contents the pixels already in the file are reused.
+     */
+    JPG(const Dimensions& dimensions, const string& backing_filename, bool keep_contents) :
+        mapped_pixels_(NULL), mapped_size_(dimensions.x * dimensions.y * NUMBER_OF_CHANNELS)
+    {
+        int fd = open(backing_filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd == -1 or (not keep_contents and ftruncate(fd, 0) != 0) or ftruncate(fd, mapped_size_) != 0)
+        {
+            throw std::runtime_error("Cannot create " + backing_filename + ": " + strerror(errno));
+        }
+        void* pixels = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(pixels == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map " + backing_filename + ": " + strerror(errno));
+        }
+        mapped_pixels_ = pixels;
+        view_ = gil::interleaved_view(dimensions.x, dimensions.y, static_cast<gil::rgb8_pixel_t*>(pixels), dimensions.x * NUMBER_OF_CHANNELS);
+    }
+
+    ~JPG()
+    {
+        if(mapped_pixels_ != NULL)
+        {
+            munmap(mapped_pixels_, mapped_size_);
+        }
+    }
+
+    void sync()
+    {
+        if(mapped_pixels_ != NULL)
+        {
+            msync(mapped_pixels_, mapped_size_, MS_ASYNC);
+        }
+    }
+
+    void write(const string& filename)
+    {
+        gil::jpeg_write_view(filename, view_, 85);
+    }
+
+    gil::rgb8c_view_t pixels() const { return view_; }
+
+    void copy_rows(const gil::rgb8c_view_t& pixels, ptrdiff_t y)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        gil::copy_pixels(pixels, gil::subimage_view(view_, 0, y, pixels.width(), pixels.height()));
+    }
+
+    void set_mosaic_stone(const Position& pos, const Dimensions& stone_size, const gil::rgb8c_view_t& tile, RenderStatistics& statistics,
+            PixelBuffer& scaled_stone)
+    {
+        gil::rgb8_view_t mosaic_stone_img_small = scaled_stone.view(stone_size);
+        gil::resize_view(tile, mosaic_stone_img_small, gil::bilinear_sampler());
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            gil::copy_pixels(mosaic_stone_img_small, subimage_view(view_, Position(pos.x * stone_size.x, pos.y * stone_size.y), stone_size));
+        }
+        statistics.add_atlas_tile();
+    }
+
+    /**
+     * Decodes just the crop build-database stored for the stone. Stones without a stored
+     * crop, or whose photo has changed since, are probed for orientation and size first.
+     * With low_resolution the crop may be decoded with as little as a quarter of the
+     * resolution of the stone. Returns whether it was, which it is not for stones whose
+     * photo could not be read at all.
+     */
+    bool set_mosaic_stone(const Position& pos, const Dimensions& stone_size, const MosaicStone& stone, RenderStatistics& statistics,
+            PixelBuffer& decoded_stone, PixelBuffer& scaled_stone, bool low_resolution = false)
+    {
+        const StoneSource* source = stone.source();
+        if(source == NULL or not source->is_current(stone.image_file_path()))
+        {
+            statistics.add_probed_stone();
+            set_mosaic_stone(pos, stone_size, stone.image_file_path(), statistics, decoded_stone, scaled_stone);
+            return false;
+        }
+        try
+        {
+            double wall_start = seconds_on_clock(CLOCK_MONOTONIC);
+            double cpu_start = seconds_on_clock(CLOCK_THREAD_CPUTIME_ID);
+            Dimensions decoded_size = low_resolution ? Dimensions(std::max(stone_size.x / 4, (ptrdiff_t)1), std::max(stone_size.y / 4, (ptrdiff_t)1)) : stone_size;
+            gil::rgb8_view_t crop = read_stone_crop(stone.image_file_path(), *source, decoded_size, decoded_stone);
+            statistics.add_stone_load(seconds_on_clock(CLOCK_MONOTONIC) - wall_start,
+                    seconds_on_clock(CLOCK_THREAD_CPUTIME_ID) - cpu_start);
+            // The crop is in the coordinates of the photo as stored, set_oriented_stone() needs them oriented.
+            Dimensions oriented_crop = crop.dimensions();
+            if(source->orientation == ROTATED_90CCW or source->orientation == ROTATED_90CW)
+            {
+                swap(oriented_crop);
+            }
+            set_oriented_stone(pos, stone_size, crop, source->orientation, oriented_crop, scaled_stone);
+        }
+        catch(std::exception& error)
+        {
+            statistics.add_stone_error(stone.image_file_path() + ": " + error.what());
+            return false;
+        }
+        return low_resolution;
+    }
+
+    /// Paints the raster cells of a stone instead of its photo, which needs no decoding at all.
+    void set_raster_cells(const Position& pos, const Dimensions& stone_size, const vector<int>& raster_values, int raster_resolution)
+    {
+        int cell_count = raster_resolution * raster_resolution;
+        boost::mutex::scoped_lock lock(mutex);
+        for(int row=0; row<raster_resolution; ++row)
+        {
+            ptrdiff_t top = row * stone_size.y / raster_resolution;
+            ptrdiff_t bottom = (row + 1) * stone_size.y / raster_resolution;
+            for(int column=0; column<raster_resolution; ++column)
+            {
+                ptrdiff_t left = column * stone_size.x / raster_resolution;
+                ptrdiff_t right = (column + 1) * stone_size.x / raster_resolution;
+                int cell = row * raster_resolution + column;
+                gil::rgb8_pixel_t color(raster_values[cell + RED_CHANNEL_INDEX*cell_count], raster_values[cell + GREEN_CHANNEL_INDEX*cell_count],
+                        raster_values[cell + BLUE_CHANNEL_INDEX*cell_count]);
+                gil::fill_pixels(gil::subimage_view(view_, pos.x * stone_size.x + left, pos.y * stone_size.y + top, right - left, bottom - top), color);
+            }
+        }
+    }
+
+    void set_mosaic_stone(const Position& pos, const Dimensions& stone_size, const string& current_path, RenderStatistics& statistics,
+            PixelBuffer& decoded_stone, PixelBuffer& scaled_stone)
+    {
+        try
+        {
+            double wall_start = seconds_on_clock(CLOCK_MONOTONIC);
+            double cpu_start = seconds_on_clock(CLOCK_THREAD_CPUTIME_ID);
+            double aspect_ratio = (double)stone_size.x/(double)stone_size.y;
+            Orientation orientation = orientation_from_image_path(current_path);
+            Dimensions photo_dimensions = gil::jpeg_read_dimensions(current_path);
+            gil::point2<std::ptrdiff_t> dimensions = aspect_ratio_cropped_dimensions(photo_dimensions, aspect_ratio, orientation);
+            gil::rgb8_view_t mosaic_stone_img_big = decoded_stone.view(photo_dimensions);
+            gil::jpeg_read_view(current_path, mosaic_stone_img_big);
+            statistics.add_stone_load(seconds_on_clock(CLOCK_MONOTONIC) - wall_start,
+                    seconds_on_clock(CLOCK_THREAD_CPUTIME_ID) - cpu_start);
+            set_oriented_stone(pos, stone_size, mosaic_stone_img_big, orientation, dimensions, scaled_stone);
+        }
+        catch(std::exception& error)
+        {
+            statistics.add_stone_error(current_path + ": " + error.what());
+        }
+    }
+
+private:
+    /// Scales the top left corner of size dimensions of the oriented photo down to the stone.
+    void set_oriented_stone(const Position& pos, const Dimensions& stone_size, const gil::rgb8_view_t& photo, Orientation orientation,
+            const Dimensions& dimensions, PixelBuffer& scaled_stone)
+    {
+        gil::rgb8_view_t mosaic_stone_img_small = scaled_stone.view(stone_size);
+
+        Position o;
+
+        switch(orientation)
+        {
+        case NOT_ROTATED:
+            gil::resize_view(gil::subimage_view(photo, o, dimensions),
+                    mosaic_stone_img_small, gil::bilinear_sampler());
+            break;
+        case ROTATED_180:
+            gil::resize_view(gil::subimage_view(rotated180_view(photo), o, dimensions),
+                    mosaic_stone_img_small, gil::bilinear_sampler());
+            break;
+        case ROTATED_90CCW:
+            gil::resize_view(gil::subimage_view(rotated90cw_view(photo), o, dimensions),
+                    mosaic_stone_img_small, gil::bilinear_sampler());
+            break;
+        case ROTATED_90CW:
+            gil::resize_view(gil::subimage_view(rotated90ccw_view(photo), o, dimensions),
+                    mosaic_stone_img_small, gil::bilinear_sampler());
+            break;
+        }
+
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            gil::copy_pixels(mosaic_stone_img_small, subimage_view(view_, Position(pos.x * stone_size.x, pos.y * stone_size.y), stone_size));
+        }
+    }
+
+    string filename_;
+    gil::rgb8_image_t image_;
+    gil::rgb8_view_t view_;
+    void* mapped_pixels_;
+    size_t mapped_size_;
+    boost::mutex mutex;
+};
+
+/**
+ * The stone chosen for every position of a mosaic. The stones belong to the database
+ * of the render, which outlives the matrix, so the matrix holds plain pointers and
+ * choosing a stone does not touch a reference count that all threads share.
+ */
+class OutputMatrix
+{
+    vector<vector<const MosaicStone*> > matrix_;
+    vector<vector<bool> > composited_;
+    mutable boost::mutex mutex;
+    mutable boost::mutex placement_mutex_;
+
+public:
+    OutputMatrix(const Dimensions& dimensions) : matrix_(dimensions.x, vector<const MosaicStone*>(dimensions.y, NULL)),
+        composited_(dimensions.x, vector<bool>(dimensions.y, false))
+    {}
+
+    OutputMatrix(const OutputMatrix& other)
+    {
+        matrix_ = other.matrix_;
+        composited_ = other.composited_;
+    }
+
+    /// Held while a stone is chosen and placed, so that the stones within min-distance do not change meanwhile.
+    boost::mutex& placement_mutex() const
+    {
+        return placement_mutex_;
+    }
+
+    void mark_composited(const Position& pos)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        composited_[pos.x][pos.y] = true;
+    }
+
+    bool is_composited(int x, int y) const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return composited_[x][y];
+    }
+
+    const MosaicStone*& operator()(const Position& pos)
+    {
+        return operator()(pos.x, pos.y);
+    }
+
+    const MosaicStone* operator() (const Position& pos) const
+    {
+        return operator()(pos.x, pos.y);
+    }
+
+    const MosaicStone*& operator()(int x, int y)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return matrix_[x][y];
+    }
+
+    const MosaicStone* operator() (int x, int y) const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return matrix_[x][y];
+    }
+
+    int xres() const {
+        boost::mutex::scoped_lock lock(mutex);
+        return matrix_.size();
+    }
+
+    int yres() const {
+        boost::mutex::scoped_lock lock(mutex);
+        return matrix_[0].size();
+    }
+};
+
+int start_from_coord_and_min_dinstance(int coord, int min_distance);
+
+int end_from_coord_and_min_distance(int coord, int min_distance, int resolution);
+
+void collect_distance_caused_excludes(const Position& pos, const OutputMatrix& output, int min_distance, vector<const MosaicStone*>& excludes);
+
+/**
+ * The stones placed just outside the min-distance around pos. Neighbouring tiles tend to
+ * look alike, so these are good candidates to start a search with.
+ */
+void collect_warm_start_candidates(const Position& pos, const OutputMatrix& output, int min_distance, vector<const MosaicStone*>& candidates);
+
+/**
+ * The closest stones of every tile of a region, found before any stone is placed. Placing
+ * a stone then only has to take the first one from its tile's list that min-distance does
+ * not exclude, and only needs a full search if it excludes all of them. Lists of
+ * (2*min-distance+1)^2 stones are never all excluded.
+ */
+class CandidateLists
+{
+public:
+    CandidateLists(const Position& origin, const Dimensions& size, size_t length) :
+        origin_(origin), size_(size), length_(length), stones_(size.x * size.y * length, NULL),
+        lookups_(0), fallbacks_(0), missing_lists_(0)
+    {}
+
+    size_t length() const { return length_; }
+
+    /// Different positions may be filled by different threads at the same time.
+    const MosaicStone** list(const Position& pos)
+    {
+        return &stones_[((pos.y - origin_.y) * size_.x + pos.x - origin_.x) * length_];
+    }
+
+    /// Sorts excluded. Returns no stone if all of the list is excluded, or if the list was never built.
+    const MosaicStone* closest_match(const Position& pos, vector<const MosaicStone*>& excluded)
+    {
+        const MosaicStone** candidates = list(pos);
+        // Every list that was built has a first stone.
+        if(candidates[0] == NULL)
+        {
+            ++missing_lists_;
+            return NULL;
+        }
+        std::sort(excluded.begin(), excluded.end());
+        ++lookups_;
+        for(size_t i=0; i<length_ and candidates[i] != NULL; ++i)
+        {
+            if(not std::binary_search(excluded.begin(), excluded.end(), candidates[i]))
+            {
+                return candidates[i];
+            }
+        }
+        ++fallbacks_;
+        return NULL;
+    }
+
+    /// Lookups of built lists only.
+    long lookups() const { return lookups_; }
+    long fallbacks() const { return fallbacks_; }
+    long missing_lists() const { return missing_lists_; }
+
+private:
+    Position origin_;
+    Dimensions size_;
+    size_t length_;
+    vector<const MosaicStone*> stones_;
+    boost::atomic<long> lookups_;
+    boost::atomic<long> fallbacks_;
+    boost::atomic<long> missing_lists_;
+};
+
+/**
+ * Persists which stone was matched to every position and whether it has been
+ * composited yet. The composited pixels themselves live in the memory-mapped
+ * image_filename(), so a checkpoint only has to write the small grid.
+ *
+ * The grid has one line per row, with the stone id of every position: positive if
+ * composited, negative if only matched and 0 if not matched yet.
+ */
+class RenderCheckpoint
+{
+public:
+    RenderCheckpoint(const string& output_filename, const string& fingerprint, const Dimensions& output_dimensions,
+            int interval_seconds, bool resume) :
+        filename_(output_filename + ".checkpoint"), fingerprint_(fingerprint), interval_seconds_(interval_seconds), resumed_(false)
+    {
+        ifstream file(filename_.c_str());
+        if(not resume or not file)
+        {
+            return;
+        }
+        string fingerprint_in_file;
+        std::getline(file, fingerprint_in_file);
+        if(fingerprint_in_file != fingerprint_)
+        {
+            throw std::runtime_error("Cannot resume: " + filename_ + " was written for different settings.");
+        }
+        // The grid alone would mark tiles as done whose pixels are lost.
+        FileStamp image_stamp;
+        if(not read_file_stamp(image_filename(), image_stamp) or
+           image_stamp.size != (boost::uint64_t)output_dimensions.x * output_dimensions.y * NUMBER_OF_CHANNELS)
+        {
+            cerr << "Cannot resume: " << image_filename() << " is missing or incomplete ==> rendering from the start" << endl;
+            return;
+        }
+        int xres, yres;
+        file >> xres >> yres;
+        ids_.assign(xres, vector<int>(yres, 0));
+        for(int y=0; y<yres; ++y)
+        {
+            for(int x=0; x<xres; ++x)
+            {
+                file >> ids_[x][y];
+            }
+        }
+        if(not file)
+        {
+            throw std::runtime_error("Cannot resume: " + filename_ + " is damaged.");
+        }
+        resumed_ = true;
+    }
+
+    string image_filename() const { return filename_ + "-image"; }
+
+    bool resumed() const { return resumed_; }
+
+    int interval_seconds() const { return interval_seconds_; }
+
+    void restore(const MosaicsDatabase& database, OutputMatrix& output) const
+    {
+        for(size_t x=0; resumed_ and x<ids_.size(); ++x)
+        {
+            for(size_t y=0; y<ids_[x].size(); ++y)
+            {
+                if(ids_[x][y] != 0)
+                {
+                    output(x, y) = database.stone_by_id(abs(ids_[x][y])).get();
+                }
+                if(ids_[x][y] > 0)
+                {
+                    output.mark_composited(Position(x, y));
+                }
+            }
+        }
+    }
+
+    void save(const OutputMatrix& output) const
+    {
+        // Only the ids are taken under the lock, so that rendering threads do not wait for the formatting.
+        vector<int> ids(output.xres() * output.yres());
+        {
+            boost::mutex::scoped_lock lock(output.placement_mutex());
+            for(int y=0; y<output.yres(); ++y)
+            {
+                for(int x=0; x<output.xres(); ++x)
+                {
+                    int id = output(x, y) ? output(x, y)->id() : 0;
+                    ids[y * output.xres() + x] = output.is_composited(x, y) ? id : -id;
+                }
+            }
+        }
+        std::stringstream grid;
+        grid << fingerprint_ << endl << output.xres() << " " << output.yres() << endl;
+        for(int y=0; y<output.yres(); ++y)
+        {
+            for(int x=0; x<output.xres(); ++x)
+            {
+                grid << (x == 0 ? "" : " ") << ids[y * output.xres() + x];
+            }
+            grid << endl;
+        }
+        replace_file(filename_, grid.str());
+    }
+
+    void remove() const
+    {
+        unlink(filename_.c_str());
+        unlink(image_filename().c_str());
+    }
+
+private:
+    string filename_;
+    string fingerprint_;
+    int interval_seconds_;
+    bool resumed_;
+    vector<vector<int> > ids_;
+};
+
+void write_checkpoints(const RenderCheckpoint* checkpoint, const OutputMatrix* output, JPG* output_image);
+
+/// The progress callback of renders that nobody watches.
+int ignore_progress(double, void*);
+
+class Progress
+{
+    int hundred_percent_equivalent_;
+    int done_so_far_;
+    mutable boost::mutex mutex_;
+
+    boost::timer timer_;
+    bool print_time_left_;
+    phomo_progress_callback callback_;
+    void* user_data_;
+    boost::atomic<bool> cancelled_;
+public:
+    /// With a callback, progress is handed to it instead of being printed.
+    Progress(int hundred_percent_equivalent, bool print_time_left = false, phomo_progress_callback callback = NULL, void* user_data = NULL)
+        : hundred_percent_equivalent_(hundred_percent_equivalent),
+          done_so_far_(0),
+          print_time_left_(print_time_left),
+          callback_(callback),
+          user_data_(user_data),
+          cancelled_(false)
+          {}
+
+    /// Whether the callback asked to cancel the render.
+    bool cancelled() const { return cancelled_; }
+
+    double status() const
+    {
+        return (double)done_so_far_/hundred_percent_equivalent_;
+    }
+
+    void inc_and_print()
+    {
+        if(callback_ != NULL)
+        {
+            inc_and_report();
+        }
+        else if(print_time_left_)
+        {
+            inc_and_print_minutes_left();
+        }
+        else
+        {
+            inc_and_print_status();
+        }
+    }
+
+    void inc_and_print_status()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++done_so_far_;
+        cout << status() * 100 << "%" << endl;
+    }
+
+    void inc_and_report()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++done_so_far_;
+        if(callback_(status(), user_data_) != 0)
+        {
+            cancelled_ = true;
+        }
+    }
+
+    void inc_and_print_minutes_left()
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        ++done_so_far_;
+        cout << minutes_left() << " minutes left" << endl;
+    }
+
+    double minutes_left() const
+    {
+        return (1.0-status())*timer_.elapsed()/status() / 60;
+    }
+};
+
+struct PlacedStone
+{
+    /// The stone_id of a cell that is to be left empty.
+    static const int NO_STONE = -1;
+
+    Position position;
+    int stone_id;
+};
+
+struct RenderSettings
+{
+    ptrdiff_t min_distance;
+    Dimensions output_dimensions;
+    Dimensions output_stone_size;
+    Dimensions resolution_in_stones;
+    // The part of the mosaic to render, in stones. The whole mosaic unless rendering distributed.
+    Position region_origin;
+    Dimensions region_size;
+    RenderSettings(const Dimensions& input_dimensions, ptrdiff_t output_width, ptrdiff_t x_resolution_in_stones, ptrdiff_t min_distance_, double aspect_ratio) :
+        min_distance(min_distance_)
+    {
+        if(x_resolution_in_stones < 1)
+        {
+            throw std::runtime_error("The resolution in stones must be at least 1.");
+        }
+        resolution_in_stones.x = x_resolution_in_stones;
+        int source_stone_width = input_dimensions.x / resolution_in_stones.x;
+        int source_stone_height = (double)source_stone_width / aspect_ratio;
+        if(source_stone_height < 1 or input_dimensions.y < source_stone_height)
+        {
+            throw std::runtime_error("The picture is too small for the resolution in stones.");
+        }
+        resolution_in_stones.y = input_dimensions.y / source_stone_height;
+        set_output_width(output_width, aspect_ratio);
+    }
+
+    /// For compositing a saved layout, whose resolution in stones is known already.
+    RenderSettings(const Dimensions& resolution_in_stones_, ptrdiff_t output_width, ptrdiff_t min_distance_, double aspect_ratio) :
+        min_distance(min_distance_), resolution_in_stones(resolution_in_stones_)
+    {
+        set_output_width(output_width, aspect_ratio);
+    }
+
+    bool renders_region() const
+    {
+        return region_origin != Position(0, 0) or region_size != resolution_in_stones;
+    }
+
+private:
+    void set_output_width(ptrdiff_t output_width, double aspect_ratio)
+    {
+        output_dimensions.x = output_width;
+        int output_stone_width = output_dimensions.x/resolution_in_stones.x;
+        int output_stone_height = (double)output_stone_width / aspect_ratio;
+        if(output_stone_height < 1)
+        {
+            throw std::runtime_error("The output width is too small for the resolution in stones.");
+        }
+        output_dimensions.y = output_stone_height * resolution_in_stones.y;
+        output_stone_size = Dimensions(output_stone_width, output_stone_height);
+
+        region_origin = Position(0, 0);
+        region_size = resolution_in_stones;
+    }
+};
+
+/**
+ * The stone matched to every position of a mosaic, saved so that the mosaic can be
+ * composited again at other output sizes without matching it again. The file has a
+ * header line, the database and its number of stones, the resolution in stones and
+ * min-distance, followed by one line of stone ids per row. Cells without a stone have
+ * the id PlacedStone::NO_STONE.
+ */
+class MosaicLayout
+{
+public:
+    /// stone_ids are 0 where there is no stone, as DistributedRenderer keeps them.
+    MosaicLayout(const vector<vector<int> >& stone_ids, const string& database_filename, const MosaicsDatabase& database, int min_distance) :
+        stone_ids_(stone_ids), database_filename_(filesystem::absolute(database_filename).string()),
+        stone_count_(database.stones().size()), database_checksum_(database.checksum()), min_distance_(min_distance)
+    {
+        BOOST_FOREACH(vector<int>& row, stone_ids_)
+        {
+            std::replace(row.begin(), row.end(), 0, (int)PlacedStone::NO_STONE);
+        }
+    }
+
+    MosaicLayout(const OutputMatrix& output, const string& database_filename, const MosaicsDatabase& database, int min_distance) :
+        stone_ids_(output.yres(), vector<int>(output.xres())), database_filename_(filesystem::absolute(database_filename).string()),
+        stone_count_(database.stones().size()), database_checksum_(database.checksum()), min_distance_(min_distance)
+    {
+        for(int y=0; y<output.yres(); ++y)
+        {
+            for(int x=0; x<output.xres(); ++x)
+            {
+                stone_ids_[y][x] = output(x, y) ? output(x, y)->id() : PlacedStone::NO_STONE;
+            }
+        }
+    }
+
+    explicit MosaicLayout(const string& filename)
+    {
+        ifstream file(filename.c_str());
+        string header;
+        std::getline(file, header);
+        std::getline(file, database_filename_);
+        int xres = 0, yres = 0;
+        file >> stone_count_ >> database_checksum_ >> xres >> yres >> min_distance_;
+        if(header != LAYOUT_HEADER or not file or xres < 1 or yres < 1)
+        {
+            throw std::runtime_error("Cannot read mosaic layout " + filename + ".");
+        }
+        // A relative path, as in a layout written by hand, is taken relative to the layout.
+        database_filename_ = filesystem::absolute(database_filename_, filesystem::absolute(filename).parent_path()).string();
+        stone_ids_.assign(yres, vector<int>(xres));
+        for(int y=0; y<yres; ++y)
+        {
+            for(int x=0; x<xres; ++x)
+            {
+                file >> stone_ids_[y][x];
+            }
+        }
+        if(not file)
+        {
+            throw std::runtime_error("Mosaic layout " + filename + " is truncated.");
+        }
+    }
+
+    void write(const string& filename) const
+    {
+        ofstream file(filename.c_str());
+        file << LAYOUT_HEADER << endl << database_filename_ << endl << stone_count_ << " " << database_checksum_ << endl
+             << stone_ids_[0].size() << " " << stone_ids_.size() << " " << min_distance_ << endl;
+        BOOST_FOREACH(const vector<int>& row, stone_ids_)
+        {
+            for(size_t x=0; x<row.size(); ++x)
+            {
+                file << (x == 0 ? "" : " ") << row[x];
+            }
+            file << endl;
+        }
+        if(not file)
+        {
+            throw std::runtime_error("Cannot write mosaic layout " + filename + ".");
+        }
+    }
+
+    const string& database_filename() const { return database_filename_; }
+
+    bool matches(const MosaicsDatabase& database) const
+    {
+        return database.stones().size() == stone_count_ and database.checksum() == database_checksum_;
+    }
+
+    int min_distance() const { return min_distance_; }
+    Dimensions resolution_in_stones() const { return Dimensions(stone_ids_[0].size(), stone_ids_.size()); }
+
+    vector<PlacedStone> placed_stones() const
+    {
+        vector<PlacedStone> placed_stones;
+        for(size_t y=0; y<stone_ids_.size(); ++y)
+        {
+            for(size_t x=0; x<stone_ids_[y].size(); ++x)
+            {
+                PlacedStone placed_stone;
+                placed_stone.position = Position(x, y);
+                placed_stone.stone_id = stone_ids_[y][x];
+                placed_stones.push_back(placed_stone);
+            }
+        }
+        return placed_stones;
+    }
+
+private:
+    static const string LAYOUT_HEADER;
+
+    vector<vector<int> > stone_ids_;
+    string database_filename_;
+    size_t stone_count_;
+    boost::uint64_t database_checksum_;
+    int min_distance_;
+};
+
+/**
+ * The deadline of a render with --time-budget. Before every tile, a render thread
+ * compares its pace with the time left and falls back to cheaper stages to finish in
+ * time: while it is behind, it searches only part of the database and composites tiles
+ * from low resolution sources, and once the time for tiles is up it paints the rest of
+ * its tiles with the raster cells of their stones. The stages every tile fell back to
+ * are kept for the report.
+ */
+class TimeBudget
+{
+public:
+    enum Degradation { PARTIAL_SEARCH = 1, LOW_RESOLUTION = 2, RASTER_CELLS = 4 };
+
+    /// Starts counting now.
+    TimeBudget(double seconds) :
+        start_(seconds_on_clock(CLOCK_MONOTONIC)), seconds_(seconds), tile_seconds_(seconds)
+    {}
+
+    /// Keeps a tenth of the budget, and the time encoding the output takes, for the end of the render.
+    void start_render(const RenderSettings& render_settings)
+    {
+        grid_size_ = render_settings.resolution_in_stones;
+        degradations_.assign(grid_size_.x * grid_size_.y, 0);
+        tile_seconds_ = 0.9 * seconds_ - JPEG_SECONDS_PER_PIXEL * render_settings.output_dimensions.x * render_settings.output_dimensions.y;
+    }
+
+    /// Whether the given share of the time for tiles is used up.
+    bool has_used(double share) const
+    {
+        return seconds_on_clock(CLOCK_MONOTONIC) - start_ >= share * tile_seconds_;
+    }
+
+    /// The stages a thread that started at thread_start and has done tiles_done tiles falls back to while tiles_left remain.
+    int degradation_for(double thread_start, long tiles_done, long tiles_left) const
+    {
+        double now = seconds_on_clock(CLOCK_MONOTONIC);
+        if(now - start_ >= tile_seconds_)
+        {
+            return PARTIAL_SEARCH | RASTER_CELLS;
+        }
+        if(tiles_done > 0 and now - start_ + (now - thread_start) / tiles_done * tiles_left > tile_seconds_)
+        {
+            return PARTIAL_SEARCH | LOW_RESOLUTION;
+        }
+        return 0;
+    }
+
+    /// Every position is only degraded by the thread that renders it.
+    void degrade(const Position& pos, int degradation)
+    {
+        degradations_[pos.y * grid_size_.x + pos.x] |= degradation;
+    }
+
+    void print_report(std::ostream& output) const
+    {
+        int counts[3] = { 0, 0, 0 };
+        int degraded = 0;
+        BOOST_FOREACH(unsigned char degradation, degradations_)
+        {
+            degraded += degradation != 0 ? 1 : 0;
+            for(int stage=0; stage<3; ++stage)
+            {
+                counts[stage] += (degradation & (1 << stage)) ? 1 : 0;
+            }
+        }
+        output << "Time budget: " << degraded << " of " << degradations_.size() << " tiles were degraded, " << counts[0]
+               << " by a partial search, " << counts[1] << " by low resolution sources and " << counts[2] << " by raster cells. "
+               << "Took " << seconds_on_clock(CLOCK_MONOTONIC) - start_ << " seconds." << endl;
+    }
+
+    /// One "x y stage,..." line per degraded tile.
+    void write_degraded_tiles(const string& filename) const
+    {
+        static const char* STAGE_NAMES[] = { "partial-search", "low-resolution", "raster-cells" };
+        ofstream file(filename.c_str());
+        for(size_t i=0; i<degradations_.size(); ++i)
+        {
+            if(degradations_[i] == 0)
+            {
+                continue;
+            }
+            file << i % grid_size_.x << " " << i / grid_size_.x << " ";
+            string separator = "";
+            for(int stage=0; stage<3; ++stage)
+            {
+                if(degradations_[i] & (1 << stage))
+                {
+                    file << separator << STAGE_NAMES[stage];
+                    separator = ",";
+                }
+            }
+            file << endl;
+        }
+        if(not file)
+        {
+            throw std::runtime_error("Cannot write " + filename + ".");
+        }
+    }
+
+private:
+    // About twice what libjpeg takes at quality 85.
+    static const double JPEG_SECONDS_PER_PIXEL;
+
+    double start_;
+    double seconds_;
+    double tile_seconds_;
+    Dimensions grid_size_;
+    vector<unsigned char> degradations_;
+};
+
+template<class SourceView>
+struct RenderParameters
+{
+    int min_distance;
+    int prefetch_window;
+    Position image_origin;
+    Dimensions source_stone_size;
+    Dimensions output_stone_size;
+    SourceView source_view;
+    MosaicsDatabase* mosaics_database;
+    StoneSearcher* searcher;
+    const TileAtlas* atlas;
+    // -1 if the atlas has no tiles big enough, so that the original photos are used.
+    int atlas_level;
+    // The level tiles come from when the time budget asks for low resolution sources.
+    int low_resolution_atlas_level;
+    TimeBudget* time_budget;
+    CandidateLists* candidate_lists;
+    JPG* output_image;
+    OutputMatrix* output;
+    Progress* progress;
+    RenderStatistics* statistics;
+};
+
+struct Shuffler
+{
+    virtual ~Shuffler() = 0;
+    virtual void shuffle(vector<Position>& positions) const = 0;
+};
+
+struct RandomShuffler
+{
+    virtual void shuffle(vector<Position>& positions) const
+    {
+        std::random_shuffle(positions.begin(), positions.end());
+    }
+};
+
+typedef pair<vector<Position>::iterator, vector<Position>::iterator> PositionsRange;
+typedef pair<Position, const MosaicStone*> Placement;
+
+/// What a render thread would otherwise allocate anew for every tile.
+struct RenderScratch
+{
+    vector<int> rastered_piece;
+    vector<boost::uint64_t> raster_sums;
+    vector<const MosaicStone*> excluded_stones;
+    vector<const MosaicStone*> warm_start_stones;
+    SearchScratch search;
+    PixelBuffer decoded_stone;
+    PixelBuffer scaled_stone;
+};
+
+template<class SourceView>
+void find_candidate_lists(RenderParameters<SourceView> params, PositionsRange positions)
+{
+    SearchScratch scratch;
+    int raster_resolution = params.mosaics_database->raster_resolution();
+    vector<int> rastered_piece(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS);
+    vector<boost::uint64_t> raster_sums;
+    for(vector<Position>::iterator pos=positions.first; pos!=positions.second; ++pos)
+    {
+        // Tiles without a list are searched when they are placed, so that half of a time budget is left for that.
+        if(params.time_budget != NULL and params.time_budget->has_used(0.5))
+        {
+            break;
+        }
+        if((*params.output)(*pos))
+        {
+            continue;
+        }
+        SourceView subimage = subimage_view(params.source_view,
+                Dimensions(pos->x*params.source_stone_size.x, pos->y*params.source_stone_size.y),
+                params.source_stone_size);
+        raster_values_from_view(subimage, raster_resolution, raster_resolution, rastered_piece, raster_sums);
+        params.searcher->find_closest_matches(rastered_piece, params.candidate_lists->length(), scratch, params.candidate_lists->list(*pos));
+    }
+}
+
+template<class SourceView>
+class RenderTask
+{
+public:
+    RenderTask(RenderParameters<SourceView>& render_params) :
+        params(render_params)//, positions_(positions)
+    {}
+
+    void operator()(const PositionsRange& positions)
+    {
+        find_and_set_stones(positions);
+    }
+private:
+
+    void find_and_set_stones(const PositionsRange& positions_)
+    {
+    //    cout << params.row_limits.min << " " << params.row_limits.max << endl;
+        OutputMatrix& output_matrix = *params.output;
+        RenderScratch scratch;
+        int raster_resolution = params.mosaics_database->raster_resolution();
+        scratch.rastered_piece.resize(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS);
+        // Matched stones wait in this ring buffer until compositing catches up, while their files are read ahead.
+        vector<Placement> pending_placements(params.prefetch_window + 1);
+        size_t first_pending = 0;
+        size_t pending_count = 0;
+        double thread_start = seconds_on_clock(CLOCK_MONOTONIC);
+
+        for(vector<Position>::iterator pos=positions_.first; pos!=positions_.second; ++pos)
+        {
+            if(params.progress->cancelled())
+            {
+                return;
+            }
+            long allocations_before = allocation_count();
+            int degradation = params.time_budget == NULL ? 0 :
+                    params.time_budget->degradation_for(thread_start, pos - positions_.first, positions_.second - pos);
+            // Positions matched before a resumed render was interrupted only need compositing.
+            const MosaicStone* mosaic_stone = output_matrix(*pos);
+
+            if(not mosaic_stone and params.candidate_lists != NULL)
+            {
+                boost::mutex::scoped_lock lock(output_matrix.placement_mutex());
+                collect_distance_caused_excludes(*pos, output_matrix, params.min_distance, scratch.excluded_stones);
+                mosaic_stone = params.candidate_lists->closest_match(*pos, scratch.excluded_stones);
+                output_matrix(*pos) = mosaic_stone;
+            }
+
+            if(not mosaic_stone)
+            {
+                timer.restart();
+                SourceView subimage = subimage_view(params.source_view,
+                        Dimensions(pos->x*params.source_stone_size.x, pos->y*params.source_stone_size.y),
+                        params.source_stone_size);
+
+
+                raster_values_from_view(subimage, raster_resolution, raster_resolution, scratch.rastered_piece, scratch.raster_sums);
+                timer.print_elapsed_with_label("Elapsed time to create rastered piece");
+
+                boost::mutex::scoped_lock lock(output_matrix.placement_mutex());
+
+                timer.restart();
+                collect_distance_caused_excludes(*pos, output_matrix, params.min_distance, scratch.excluded_stones);
+                timer.print_elapsed_with_label("Elapsed time to find excludes");
+
+                timer.restart();
+                collect_warm_start_candidates(*pos, output_matrix, params.min_distance, scratch.warm_start_stones);
+                mosaic_stone = params.searcher->find_closest_match(scratch.rastered_piece, scratch.excluded_stones, scratch.warm_start_stones,
+                        scratch.search, degradation & TimeBudget::PARTIAL_SEARCH);
+                timer.print_elapsed_with_label("Elapsed time to find stone");
+                if(degradation & TimeBudget::PARTIAL_SEARCH)
+                {
+                    params.time_budget->degrade(*pos, TimeBudget::PARTIAL_SEARCH);
+                }
+
+                output_matrix(*pos) = mosaic_stone;
+            }
+
+            if(params.prefetch_window > 0)
+            {
+                if(uses_atlas_for(*mosaic_stone))
+                {
+                    params.atlas->prefetch(params.atlas_level, mosaic_stone->id());
+                }
+                else
+                {
+                    prefetch_file(mosaic_stone->image_file_path());
+                }
+            }
+            pending_placements[(first_pending + pending_count) % pending_placements.size()] = Placement(*pos, mosaic_stone);
+            ++pending_count;
+            if(pending_count > (size_t)params.prefetch_window)
+            {
+                set_stone(pending_placements[first_pending], scratch, degradation);
+                first_pending = (first_pending + 1) % pending_placements.size();
+                --pending_count;
+            }
+            params.statistics->add_tile_allocations(allocation_count() - allocations_before);
+        }
+        for(; pending_count > 0 and not params.progress->cancelled(); --pending_count)
+        {
+            int degradation = params.time_budget == NULL ? 0 :
+                    params.time_budget->degradation_for(thread_start, positions_.second - positions_.first, pending_count);
+            set_stone(pending_placements[first_pending], scratch, degradation);
+            first_pending = (first_pending + 1) % pending_placements.size();
+        }
+    }
+
+    void set_stone(const Placement& placement, RenderScratch& scratch, int degradation)
+    {
+        Position image_position(placement.first.x - params.image_origin.x, placement.first.y - params.image_origin.y);
+        const MosaicStone& stone = *placement.second;
+        if(degradation & TimeBudget::RASTER_CELLS)
+        {
+            params.output_image->set_raster_cells(image_position, params.output_stone_size, stone.raster_values(),
+                    params.mosaics_database->raster_resolution());
+            params.time_budget->degrade(placement.first, TimeBudget::RASTER_CELLS);
+        }
+        else if(uses_atlas_for(stone))
+        {
+            params.output_image->set_mosaic_stone(image_position, params.output_stone_size,
+                    params.atlas->tile(params.atlas_level, stone.id()), *params.statistics, scratch.scaled_stone);
+        }
+        else if((degradation & TimeBudget::LOW_RESOLUTION) and params.low_resolution_atlas_level != -1 and params.atlas->has_tile(stone.id()))
+        {
+            params.output_image->set_mosaic_stone(image_position, params.output_stone_size,
+                    params.atlas->tile(params.low_resolution_atlas_level, stone.id()), *params.statistics, scratch.scaled_stone);
+            params.time_budget->degrade(placement.first, TimeBudget::LOW_RESOLUTION);
+        }
+        else if(params.output_image->set_mosaic_stone(image_position, params.output_stone_size, stone, *params.statistics,
+                    scratch.decoded_stone, scratch.scaled_stone, degradation & TimeBudget::LOW_RESOLUTION))
+        {
+            params.time_budget->degrade(placement.first, TimeBudget::LOW_RESOLUTION);
+        }
+        params.output->mark_composited(placement.first);
+//            progress->inc_and_print_status();
+        params.progress->inc_and_print();
+    }
+
+    bool uses_atlas_for(const MosaicStone& stone) const
+    {
+        return params.atlas_level != -1 and params.atlas->has_tile(stone.id());
+    }
+
+    RenderParameters<SourceView> params;
+//    PositionsRange positions_;
+};
+
+class Renderer
+{
+
+public:
+    Renderer(MosaicsDatabase& mosaics_database, StoneSearcher& searcher, int number_of_threads, int prefetch_window, int candidates_per_tile,
+            const TileAtlas* atlas = NULL, TimeBudget* time_budget = NULL) :
+        number_of_threads_(number_of_threads), prefetch_window_(prefetch_window), candidates_per_tile_(candidates_per_tile),
+        mosaics_database_(mosaics_database), searcher_(searcher), atlas_(atlas), time_budget_(time_budget),
+        progress_callback_(NULL), progress_user_data_(NULL), cancelled_(false)
+    {
+        if(number_of_threads < 1)
+        {
+            throw std::runtime_error("number-of-threads must be at least 1.");
+        }
+        if(prefetch_window < 0)
+        {
+            // The ring buffer of a render thread holds prefetch_window + 1 placements.
+            throw std::runtime_error("prefetch-window must not be negative.");
+        }
+    }
+
+    const RenderStatistics& statistics() const { return statistics_; }
+
+    /// Hands the progress of render() to callback instead of printing it, or keeps it to itself without one. The callback may cancel the render.
+    void report_progress_to(phomo_progress_callback callback, void* user_data)
+    {
+        progress_callback_ = callback != NULL ? callback : ignore_progress;
+        progress_user_data_ = user_data;
+    }
+
+    /// Whether the last render() was cancelled, which leaves tiles of its region empty.
+    bool cancelled() const { return cancelled_; }
+
+    template<class SourceView>
+    /**
+     * Renders the region of render_settings into output_image, whose top left corner is
+     * the top left corner of the region. fixed_stones are stones placed already. Outside
+     * the region they are respected for min-distance, inside they are only composited.
+     * Cells fixed to PlacedStone::NO_STONE stay empty.
+     */
+    OutputMatrix render(const SourceView& source_view, JPG& output_image, const RenderSettings& render_settings, bool print_time_left,
+            const RenderCheckpoint* checkpoint = NULL, const vector<PlacedStone>* fixed_stones = NULL)
+    {
+        int source_stone_width = source_view.width() / render_settings.resolution_in_stones.x;
+        int source_stone_height = source_stone_width / mosaics_database_.aspect_ratio();
+        int output_stone_width = render_settings.output_dimensions.x / render_settings.resolution_in_stones.x;
+        int output_stone_height = (double)output_stone_width / mosaics_database_.aspect_ratio();
+
+        cancelled_ = false;
+        OutputMatrix output(render_settings.resolution_in_stones);
+        if(checkpoint != NULL)
+        {
+            checkpoint->restore(mosaics_database_, output);
+        }
+        if(fixed_stones != NULL)
+        {
+            BOOST_FOREACH(const PlacedStone& fixed_stone, *fixed_stones)
+            {
+                if(fixed_stone.stone_id == PlacedStone::NO_STONE)
+                {
+                    // Neither searched nor composited.
+                    output.mark_composited(fixed_stone.position);
+                }
+                else
+                {
+                    output(fixed_stone.position) = mosaics_database_.stone_by_id(fixed_stone.stone_id).get();
+                }
+            }
+        }
+
+        vector<Position> positions;
+
+        if(static_cast<size_t>(render_settings.min_distance *render_settings.min_distance) > mosaics_database_.stones().size())
+        {
+            throw std::runtime_error("Not enough stones for current settings. Either use a bigger database or reduce min-distance.");
+        }
+
+        for(int i=render_settings.region_origin.y;i<render_settings.region_origin.y+render_settings.region_size.y;++i)
+        {
+            for(int j=render_settings.region_origin.x;j<render_settings.region_origin.x+render_settings.region_size.x;++j)
+            {
+                if(not output.is_composited(j, i))
+                {
+                    Position position; position.x = j; position.y = i;
+                    positions.push_back(position);
+                }
+            }
+        }
+        int number_of_stones = positions.size();
+        if(number_of_stones == 0)
+        {
+            return output;
+        }
+        std::random_shuffle(positions.begin(), positions.end());
+        int number_of_threads = number_of_threads_;
+        if(number_of_threads > number_of_stones)
+        {
+            // Regions, resumed renders and layouts can have fewer tiles left than threads.
+            if(not render_settings.renders_region() and (checkpoint == NULL or not checkpoint->resumed()) and fixed_stones == NULL)
+            {
+                throw std::runtime_error("Cannot use more threads than mosaic stones.");
+            }
+            number_of_threads = number_of_stones;
+        }
+        int stones_per_thread = number_of_stones / number_of_threads;
+
+        Progress progress(number_of_stones, print_time_left, progress_callback_, progress_user_data_);
+
+        ThreadList thread_list;
+        RenderParameters<SourceView> render_parameters;
+        render_parameters.min_distance = render_settings.min_distance;
+        render_parameters.prefetch_window = prefetch_window_;
+        render_parameters.image_origin = render_settings.region_origin;
+        render_parameters.source_stone_size = Dimensions(source_stone_width, source_stone_height);
+        render_parameters.output_stone_size = Dimensions(output_stone_width, output_stone_height);
+        render_parameters.mosaics_database = &mosaics_database_;
+        render_parameters.searcher = &searcher_;
+        render_parameters.atlas = atlas_;
+        render_parameters.atlas_level = atlas_ == NULL ? -1 : atlas_->level_for(render_parameters.output_stone_size);
+        render_parameters.low_resolution_atlas_level = atlas_ == NULL ? -1 : atlas_->biggest_level();
+        render_parameters.time_budget = time_budget_;
+        if(time_budget_ != NULL)
+        {
+            time_budget_->start_render(render_settings);
+        }
+        render_parameters.output = &output;
+        render_parameters.output_image = &output_image;
+        render_parameters.progress = &progress;
+        render_parameters.statistics = &statistics_;
+        render_parameters.source_view = source_view;
+        render_parameters.candidate_lists = NULL;
+
+        boost::shared_ptr<CandidateLists> candidate_lists;
+        if(candidates_per_tile_ > 0)
+        {
+            double start = seconds_on_clock(CLOCK_MONOTONIC);
+            candidate_lists.reset(new CandidateLists(render_settings.region_origin, render_settings.region_size, candidates_per_tile_));
+            render_parameters.candidate_lists = candidate_lists.get();
+            ThreadList candidate_thread_list;
+            for(int i=0; i<number_of_threads; ++i)
+            {
+                candidate_thread_list.push_back(ThreadPtr(new boost::thread(find_candidate_lists<SourceView>, render_parameters,
+                        PositionsRange(positions.begin() + i*stones_per_thread,
+                                i == number_of_threads-1 ? positions.end() : positions.begin() + (i+1)*stones_per_thread))));
+            }
+            BOOST_FOREACH(ThreadPtr thread, candidate_thread_list)
+            {
+                thread->join();
+            }
+            statistics_.add_candidate_lists(candidates_per_tile_, number_of_stones, seconds_on_clock(CLOCK_MONOTONIC) - start);
+        }
+
+        RenderTask<SourceView> render_task(render_parameters);
+        for(int i=0; i<number_of_threads-1;++i)
+        {
+            thread_list.push_back(ThreadPtr(new boost::thread(render_task,
+                    PositionsRange(positions.begin() + i*stones_per_thread, positions.begin() + i*stones_per_thread+stones_per_thread))));
+        }
+        thread_list.push_back(ThreadPtr(new boost::thread(render_task,
+                PositionsRange(positions.begin()+(number_of_threads-1)*stones_per_thread,
+                        positions.begin()+number_of_stones))));
+
+        ThreadPtr checkpoint_writer;
+        if(checkpoint != NULL and checkpoint->interval_seconds() > 0)
+        {
+            checkpoint_writer.reset(new boost::thread(write_checkpoints, checkpoint, &output, &output_image));
+        }
+
+        BOOST_FOREACH(ThreadPtr thread, thread_list)
+        {
+            thread->join();
+        }
+        cancelled_ = progress.cancelled();
+        if(candidate_lists)
+        {
+            statistics_.add_candidate_list_lookups(candidate_lists->lookups(), candidate_lists->fallbacks(),
+                    candidate_lists->missing_lists());
+        }
+        if(checkpoint != NULL and checkpoint_writer)
+        {
+            checkpoint_writer->interrupt();
+            checkpoint_writer->join();
+            output_image.sync();
+            checkpoint->save(output);
+        }
+        return output;
+    }
+private:
+    int number_of_threads_;
+    int prefetch_window_;
+    int candidates_per_tile_;
+    MosaicsDatabase& mosaics_database_;
+    StoneSearcher& searcher_;
+    const TileAtlas* atlas_;
+    TimeBudget* time_budget_;
+    phomo_progress_callback progress_callback_;
+    void* progress_user_data_;
+    bool cancelled_;
+    RenderStatistics statistics_;
+};
+
+Dimensions swap_dimensions_if(const Dimensions& dimensions, Orientation orientation);
+
+template<class Renderer>
+OutputMatrix render_oriented(Renderer& renderer, const gil::rgb8_view_t& source_view, Orientation orientation, JPG& output_image,
+        const RenderSettings& render_settings, bool print_time_left, const RenderCheckpoint* checkpoint = NULL,
+        const vector<PlacedStone>* fixed_stones = NULL)
+{
+    switch(orientation)
+    {
+    case ROTATED_180:
+        return renderer.render(gil::rotated180_view(source_view), output_image, render_settings, print_time_left, checkpoint, fixed_stones);
+    case ROTATED_90CCW:
+        return renderer.render(gil::rotated90cw_view(source_view), output_image, render_settings, print_time_left, checkpoint, fixed_stones);
+    case ROTATED_90CW:
+        return renderer.render(gil::rotated90ccw_view(source_view), output_image, render_settings, print_time_left, checkpoint, fixed_stones);
+    default:
+        return renderer.render(source_view, output_image, render_settings, print_time_left, checkpoint, fixed_stones);
+    }
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "search.h"
+
+string index_filename_from_database_filename(const string& database_filename)
+{
+    return database_filename + ".ivf";
+}
+
+void build_index(const string& database_filename, int list_count)
+{
+    MosaicsDatabase mosaics_database(database_filename);
+    InvertedFileIndex index(mosaics_database, list_count);
+    index.write(index_filename_from_database_filename(database_filename), mosaics_database);
+    cout << "Built search index with " << list_count << " lists for " << mosaics_database.stones().size() << " stones." << endl;
+}
+
+const size_t StoneSearcher::WARM_START_CANDIDATES;
+const size_t StoneSearcher::PARTIAL_SEARCH_CANDIDATES;
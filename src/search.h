@@ -0,0 +1,522 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Finding the stones that match a tile best, exactly or approximately with an inverted
+ * file index next to the database.
+ */
+#ifndef PHOMO_SEARCH_H
+#define PHOMO_SEARCH_H
+
+#include "database.h"
+
+/// The stone of an iterator over stones, whether they are shared or plain pointers.
+inline const MosaicStone* stone_pointer(const MosaicStonePtr& stone) { return stone.get(); }
+inline const MosaicStone* stone_pointer(const MosaicStone* stone) { return stone; }
+
+/**
+ * Replaces best_stone by the stone in [begin, end) that deviates least from rastered_piece,
+ * if it is not excluded and deviates less than best_deviation, which is updated with its
+ * deviation. Of stones that deviate alike the one first in the database wins, as in a
+ * search of the whole database, whatever order the stones are tried in.
+ */
+template<class StoneIterator>
+void improve_match(StoneIterator begin, StoneIterator end, const vector<int>& rastered_piece, const vector<const MosaicStone*>& excluded,
+        int& best_deviation, const MosaicStone*& best_stone, long* values_examined = NULL)
+{
+    for(StoneIterator stone = begin; stone != end; ++stone)
+    {
+        if (std::find(excluded.begin(), excluded.end(), stone_pointer(*stone)) == excluded.end())
+        {
+            // calc_deviation() gives up on deviations of at least its bound, so a tie needs a bound one higher.
+            int deviation = (*stone)->calc_deviation(rastered_piece, best_deviation == -1 ? -1 : best_deviation + 1, values_examined);
+            if (deviation != -1 and (deviation < best_deviation or best_deviation == -1 or (*stone)->id() < best_stone->id()))
+            {
+                best_deviation = deviation;
+                best_stone = stone_pointer(*stone);
+            }
+        }
+    }
+}
+
+const int TRAINING_STONES_PER_LIST = 64;
+const int KMEANS_ITERATIONS = 10;
+
+string index_filename_from_database_filename(const string& database_filename);
+
+/**
+ * Approximate search index: the stones are partitioned into lists by k-means on their
+ * raster values, and a search only scans the lists whose centroids are closest to
+ * the query.
+ */
+class InvertedFileIndex
+{
+public:
+    InvertedFileIndex(const MosaicsDatabase& database, int list_count)
+    {
+        vector<MosaicStonePtr> stones(database.stones().begin(), database.stones().end());
+        if(stones.empty() or list_count < 1)
+        {
+            throw std::runtime_error("Cannot build an index without stones or lists.");
+        }
+        list_count = std::min<size_t>(list_count, stones.size());
+
+        // Training on a sample keeps the build time independent of the database size.
+        size_t sample_step = std::max<size_t>(1, stones.size() / (list_count * TRAINING_STONES_PER_LIST));
+        vector<MosaicStonePtr> training_stones;
+        for(size_t i=0; i<stones.size(); i+=sample_step)
+        {
+            training_stones.push_back(stones[i]);
+        }
+        for(int i=0; i<list_count; ++i)
+        {
+            const vector<int>& values = training_stones[i * training_stones.size() / list_count]->raster_values();
+            centroids_.push_back(vector<double>(values.begin(), values.end()));
+        }
+        for(int iteration=0; iteration<KMEANS_ITERATIONS; ++iteration)
+        {
+            vector<vector<double> > sums(list_count, vector<double>(centroids_[0].size(), 0.0));
+            vector<int> counts(list_count, 0);
+            BOOST_FOREACH(MosaicStonePtr stone, training_stones)
+            {
+                int nearest = nearest_centroid(stone->raster_values());
+                for(size_t i=0; i<sums[nearest].size(); ++i)
+                {
+                    sums[nearest][i] += (*stone)[i];
+                }
+                ++counts[nearest];
+            }
+            for(int list_index=0; list_index<list_count; ++list_index)
+            {
+                for(size_t i=0; counts[list_index] != 0 and i<sums[list_index].size(); ++i)
+                {
+                    centroids_[list_index][i] = sums[list_index][i] / counts[list_index];
+                }
+            }
+        }
+
+        lists_.resize(list_count);
+        BOOST_FOREACH(MosaicStonePtr stone, stones)
+        {
+            lists_[nearest_centroid(stone->raster_values())].push_back(stone.get());
+        }
+    }
+
+    InvertedFileIndex(const string& index_filename, const MosaicsDatabase& database)
+    {
+        ifstream file(index_filename.c_str());
+        string line;
+        std::getline(file, line);
+        std::istringstream header(line);
+        size_t list_count, value_count, stone_count;
+        boost::uint64_t database_checksum;
+        if(not (header >> list_count >> value_count >> stone_count >> database_checksum))
+        {
+            throw std::runtime_error("Cannot read index " + index_filename + ". Create it with build-index.");
+        }
+        int raster_resolution = database.raster_resolution();
+        if(stone_count != database.stones().size() or database_checksum != database.checksum()
+                or value_count != (size_t)(raster_resolution*raster_resolution*NUMBER_OF_CHANNELS))
+        {
+            throw std::runtime_error("Index " + index_filename + " does not match the database. Rebuild it with build-index.");
+        }
+        if(list_count < 1 or list_count > stone_count)
+        {
+            throw std::runtime_error("Index " + index_filename + " is corrupt. Rebuild it with build-index.");
+        }
+        centroids_.resize(list_count);
+        lists_.resize(list_count);
+        size_t listed_stones = 0;
+        for(size_t list_index=0; list_index<list_count; ++list_index)
+        {
+            // Every list is a line with its centroid and a line with the ids of its stones.
+            vector<string> parts;
+            if(not std::getline(file, line))
+            {
+                throw std::runtime_error("Index " + index_filename + " is truncated. Rebuild it with build-index.");
+            }
+            split(parts, line, is_any_of("|"));
+            if(parts.size() != value_count)
+            {
+                throw std::runtime_error("Index " + index_filename + " is corrupt. Rebuild it with build-index.");
+            }
+            BOOST_FOREACH(const string& part, parts)
+            {
+                centroids_[list_index].push_back(lexical_cast<double>(part));
+            }
+            if(not std::getline(file, line))
+            {
+                throw std::runtime_error("Index " + index_filename + " is truncated. Rebuild it with build-index.");
+            }
+            if(line.empty())
+            {
+                continue;
+            }
+            split(parts, line, is_any_of("|"));
+            listed_stones += parts.size();
+            if(listed_stones > stone_count)
+            {
+                throw std::runtime_error("Index " + index_filename + " lists more stones than the database has. Rebuild it with build-index.");
+            }
+            BOOST_FOREACH(const string& part, parts)
+            {
+                lists_[list_index].push_back(database.stone_by_id(lexical_cast<int>(part)).get());
+            }
+        }
+    }
+
+    void write(const string& index_filename, const MosaicsDatabase& database) const
+    {
+        ofstream file(index_filename.c_str());
+        file << centroids_.size() << " " << centroids_[0].size() << " " << database.stones().size() << " " << database.checksum() << endl;
+        for(size_t list_index=0; list_index<centroids_.size(); ++list_index)
+        {
+            for(size_t i=0; i<centroids_[list_index].size(); ++i)
+            {
+                file << (i == 0 ? "" : "|") << centroids_[list_index][i];
+            }
+            file << endl;
+            for(size_t i=0; i<lists_[list_index].size(); ++i)
+            {
+                file << (i == 0 ? "" : "|") << lists_[list_index][i]->id();
+            }
+            file << endl;
+        }
+    }
+
+    /// distances is only passed in to be reused between calls.
+    void collect_candidates(const vector<int>& rastered_piece, int probes, vector<pair<double, int> >& distances, vector<const MosaicStone*>& candidates) const
+    {
+        distances.resize(centroids_.size());
+        for(size_t list_index=0; list_index<centroids_.size(); ++list_index)
+        {
+            distances[list_index] = pair<double, int>(squared_distance(centroids_[list_index], rastered_piece), list_index);
+        }
+        size_t probed_lists = std::min<size_t>(probes, distances.size());
+        std::partial_sort(distances.begin(), distances.begin() + probed_lists, distances.end());
+        for(size_t i=0; i<probed_lists; ++i)
+        {
+            const vector<const MosaicStone*>& stones = lists_[distances[i].second];
+            candidates.insert(candidates.end(), stones.begin(), stones.end());
+        }
+    }
+
+private:
+    static double squared_distance(const vector<double>& centroid, const vector<int>& values)
+    {
+        double distance = 0;
+        for(size_t i=0; i<centroid.size(); ++i)
+        {
+            distance += (centroid[i] - values[i]) * (centroid[i] - values[i]);
+        }
+        return distance;
+    }
+
+    int nearest_centroid(const vector<int>& values) const
+    {
+        int nearest = 0;
+        double nearest_distance = squared_distance(centroids_[0], values);
+        for(size_t list_index=1; list_index<centroids_.size(); ++list_index)
+        {
+            double distance = squared_distance(centroids_[list_index], values);
+            if(distance < nearest_distance)
+            {
+                nearest_distance = distance;
+                nearest = list_index;
+            }
+        }
+        return nearest;
+    }
+
+    vector<vector<double> > centroids_;
+    // The stones belong to the database the index was built or read for.
+    vector<vector<const MosaicStone*> > lists_;
+};
+
+void build_index(const string& database_filename, int list_count);
+
+/// Buffers a render thread reuses for the search of every tile.
+struct SearchScratch
+{
+    vector<int> query;
+    vector<pair<double, int> > list_distances;
+    vector<const MosaicStone*> candidates;
+    vector<pair<int, const MosaicStone*> > closest;
+};
+
+/**
+ * Finds the best stone for a tile, either exactly or, when an index and a probe count
+ * are given, approximately. The approximate search falls back to the exact one if all
+ * candidates it found are excluded.
+ */
+class StoneSearcher
+{
+public:
+    StoneSearcher(const MosaicsDatabase& database, const InvertedFileIndex* index, int search_probes, bool measure_recall) :
+        database_(database), index_(index), search_probes_(search_probes), measure_recall_(measure_recall),
+        searches_(0), stones_examined_(0), values_examined_(0), warm_start_stones_examined_(0), warm_start_values_examined_(0),
+        approximate_searches_(0), candidates_examined_(0), fallbacks_(0), exact_matches_(0)
+    {
+        vector<BrightnessAndStone> stones_by_brightness;
+        BOOST_FOREACH(MosaicStonePtr stone, database.stones())
+        {
+            stones_by_brightness.push_back(BrightnessAndStone(brightness(stone->raster_values()), stone.get()));
+        }
+        std::sort(stones_by_brightness.begin(), stones_by_brightness.end(), less_bright);
+        boost::shared_ptr<BrightnessOrder> order(new BrightnessOrder);
+        BOOST_FOREACH(const BrightnessAndStone& stone, stones_by_brightness)
+        {
+            order->brightnesses.push_back(stone.first);
+            order->stones.push_back(stone.second);
+        }
+        by_brightness_ = order;
+    }
+
+    /// Searches the database of other with another probe count, without sorting its stones again. Counts its searches apart.
+    StoneSearcher(const StoneSearcher& other, int search_probes) :
+        database_(other.database_), index_(other.index_), search_probes_(search_probes), measure_recall_(other.measure_recall_),
+        by_brightness_(other.by_brightness_), searches_(0), stones_examined_(0), values_examined_(0), warm_start_stones_examined_(0),
+        warm_start_values_examined_(0), approximate_searches_(0), candidates_examined_(0), fallbacks_(0), exact_matches_(0)
+    {}
+
+    /**
+     * neighbours are stones that were chosen close to the tile. Like the stones of similar
+     * brightness they are likely to match well, and are tried first, so that most other
+     * stones can be dismissed after comparing only a few of their values.
+     */
+    const MosaicStone* find_closest_match(const vector<int>& rastered_piece, const vector<const MosaicStone*>& excluded, const vector<const MosaicStone*>& neighbours,
+            SearchScratch& scratch, bool partial = false)
+    {
+        vector<int>& query = scratch.query;
+        query.resize(rastered_piece.size());
+        database_.to_search_order(rastered_piece, query);
+        int best_deviation = -1;
+        const MosaicStone* best_stone = NULL;
+        if(partial)
+        {
+            // A wider range of stones of similar brightness stands in for the database. It
+            // is wider than the excluded stones, so that one of them is never all of it.
+            improve_match(neighbours.begin(), neighbours.end(), query, excluded, best_deviation, best_stone);
+            improve_match_by_brightness(rastered_piece, query, excluded, std::max(PARTIAL_SEARCH_CANDIDATES, excluded.size() + 1),
+                    best_deviation, best_stone, NULL);
+            return checked_match(best_stone);
+        }
+        // The warm start is counted apart, so that the values compared per stone of the
+        // database show how much sooner its early exit bites.
+        long warm_start_values_examined = 0;
+        improve_match(neighbours.begin(), neighbours.end(), query, excluded, best_deviation, best_stone, &warm_start_values_examined);
+        size_t brightness_candidates = improve_match_by_brightness(rastered_piece, query, excluded, WARM_START_CANDIDATES,
+                best_deviation, best_stone, &warm_start_values_examined);
+        int warm_start_deviation = best_deviation;
+        const MosaicStone* warm_start_stone = best_stone;
+
+        long values_examined = 0;
+        if(index_ == NULL or search_probes_ <= 0)
+        {
+            improve_match(database_.stones().begin(), database_.stones().end(), query, excluded, best_deviation, best_stone, &values_examined);
+            count_search(database_.stones().size(), values_examined, neighbours.size() + brightness_candidates, warm_start_values_examined);
+        }
+        else
+        {
+            vector<const MosaicStone*>& candidates = scratch.candidates;
+            candidates.clear();
+            index_->collect_candidates(rastered_piece, search_probes_, scratch.list_distances, candidates);
+            ++approximate_searches_;
+            candidates_examined_ += candidates.size();
+            improve_match(candidates.begin(), candidates.end(), query, excluded, best_deviation, best_stone, &values_examined);
+            if(not best_stone)
+            {
+                ++fallbacks_;
+                improve_match(database_.stones().begin(), database_.stones().end(), query, excluded, best_deviation, best_stone, &values_examined);
+            }
+            else if(measure_recall_)
+            {
+                int exact_deviation = warm_start_deviation;
+                const MosaicStone* exact_stone = warm_start_stone;
+                improve_match(database_.stones().begin(), database_.stones().end(), query, excluded, exact_deviation, exact_stone);
+                if(exact_deviation == best_deviation)
+                {
+                    ++exact_matches_;
+                }
+            }
+        }
+        return checked_match(best_stone);
+    }
+
+    /**
+     * Fills closest with the count stones closest to rastered_piece, the closest first. With
+     * an index, only its candidates are considered. If there are not enough stones, the
+     * rest of closest is NULL.
+     */
+    void find_closest_matches(const vector<int>& rastered_piece, size_t count, SearchScratch& scratch, const MosaicStone** closest) const
+    {
+        vector<int>& query = scratch.query;
+        query.resize(rastered_piece.size());
+        database_.to_search_order(rastered_piece, query);
+        scratch.closest.clear();
+        if(index_ == NULL or search_probes_ <= 0)
+        {
+            add_closest(database_.stones().begin(), database_.stones().end(), query, count, scratch.closest);
+        }
+        else
+        {
+            scratch.candidates.clear();
+            index_->collect_candidates(rastered_piece, search_probes_, scratch.list_distances, scratch.candidates);
+            add_closest(scratch.candidates.begin(), scratch.candidates.end(), query, count, scratch.closest);
+        }
+        std::sort_heap(scratch.closest.begin(), scratch.closest.end(), closer);
+        for(size_t i=0; i<count; ++i)
+        {
+            closest[i] = i < scratch.closest.size() ? scratch.closest[i].second : NULL;
+        }
+    }
+
+    void print_statistics(std::ostream& output) const
+    {
+        if(searches_ != 0)
+        {
+            output << "Exact search compared " << (double)values_examined_ / stones_examined_ << " of "
+                   << database_.raster_resolution() * database_.raster_resolution() * NUMBER_OF_CHANNELS
+                   << " raster values per stone on average." << endl;
+            output << "Warm start tried " << (double)warm_start_stones_examined_ / searches_ << " stones per search and compared "
+                   << (warm_start_stones_examined_ == 0 ? 0.0 : (double)warm_start_values_examined_ / warm_start_stones_examined_)
+                   << " raster values per stone on average." << endl;
+        }
+        if(approximate_searches_ == 0)
+        {
+            return;
+        }
+        output << "Approximate search examined " << (double)candidates_examined_ / approximate_searches_ << " of "
+               << database_.stones().size() << " stones per tile on average, " << fallbacks_ << " of "
+               << approximate_searches_ << " searches fell back to the exact search." << endl;
+        if(measure_recall_)
+        {
+            output << "Recall of the approximate search: " << 100.0 * (exact_matches_ + fallbacks_) / approximate_searches_ << "%" << endl;
+        }
+    }
+
+private:
+    typedef pair<int, const MosaicStone*> BrightnessAndStone;
+
+    /// In two vectors, so that the stones closest in brightness to a tile are a range of stones.
+    struct BrightnessOrder
+    {
+        vector<int> brightnesses;
+        vector<const MosaicStone*> stones;
+    };
+
+    static int brightness(const vector<int>& raster_values)
+    {
+        int sum = 0;
+        BOOST_FOREACH(int value, raster_values)
+        {
+            sum += value;
+        }
+        return sum;
+    }
+
+    static bool less_bright(const BrightnessAndStone& a, const BrightnessAndStone& b)
+    {
+        return a.first < b.first;
+    }
+
+    static const MosaicStone* checked_match(const MosaicStone* stone)
+    {
+        if(not stone)
+        {
+            throw std::runtime_error("Not enough stones for current parameters. Try reducing min-distance.");
+        }
+        return stone;
+    }
+
+    /**
+     * Tries the count stones closest in brightness to the tile, half of them darker and half
+     * of them brighter, if there are enough. Returns how many stones it tried.
+     */
+    size_t improve_match_by_brightness(const vector<int>& rastered_piece, const vector<int>& query, const vector<const MosaicStone*>& excluded,
+            size_t count, int& best_deviation, const MosaicStone*& best_stone, long* values_examined) const
+    {
+        const vector<int>& brightnesses = by_brightness_->brightnesses;
+        const vector<const MosaicStone*>& stones = by_brightness_->stones;
+        count = std::min(count, stones.size());
+        size_t middle = std::lower_bound(brightnesses.begin(), brightnesses.end(), brightness(rastered_piece)) - brightnesses.begin();
+        size_t begin = std::min(middle - std::min(middle, count / 2), stones.size() - count);
+        improve_match(stones.begin() + begin, stones.begin() + begin + count,
+                query, excluded, best_deviation, best_stone, values_examined);
+        return count;
+    }
+
+    /// Of stones that deviate alike, the one first in the database is closer, as in improve_match().
+    static bool closer(const pair<int, const MosaicStone*>& a, const pair<int, const MosaicStone*>& b)
+    {
+        return a.first < b.first or (a.first == b.first and a.second->id() < b.second->id());
+    }
+
+    /// closest is a max-heap of the at most count closest stones found so far.
+    template<class StoneIterator>
+    static void add_closest(StoneIterator begin, StoneIterator end, const vector<int>& query, size_t count,
+            vector<pair<int, const MosaicStone*> >& closest)
+    {
+        for(StoneIterator stone = begin; stone != end; ++stone)
+        {
+            // Bounded one higher than the farthest stone, which a tie may still replace.
+            int deviation = (*stone)->calc_deviation(query, closest.size() < count ? -1 : closest.front().first + 1);
+            pair<int, const MosaicStone*> candidate(deviation, stone_pointer(*stone));
+            if(deviation == -1 or (closest.size() == count and not closer(candidate, closest.front())))
+            {
+                continue;
+            }
+            if(closest.size() == count)
+            {
+                std::pop_heap(closest.begin(), closest.end(), closer);
+                closest.pop_back();
+            }
+            closest.push_back(candidate);
+            std::push_heap(closest.begin(), closest.end(), closer);
+        }
+    }
+
+    void count_search(long stones_examined, long values_examined, long warm_start_stones_examined, long warm_start_values_examined)
+    {
+        ++searches_;
+        stones_examined_ += stones_examined;
+        values_examined_ += values_examined;
+        warm_start_stones_examined_ += warm_start_stones_examined;
+        warm_start_values_examined_ += warm_start_values_examined;
+    }
+
+    static const size_t WARM_START_CANDIDATES = 8;
+    static const size_t PARTIAL_SEARCH_CANDIDATES = 64;
+
+    const MosaicsDatabase& database_;
+    const InvertedFileIndex* index_;
+    int search_probes_;
+    bool measure_recall_;
+    boost::shared_ptr<const BrightnessOrder> by_brightness_;
+    boost::atomic<long> searches_;
+    boost::atomic<long> stones_examined_;
+    boost::atomic<long> values_examined_;
+    boost::atomic<long> warm_start_stones_examined_;
+    boost::atomic<long> warm_start_values_examined_;
+    boost::atomic<long> approximate_searches_;
+    boost::atomic<long> candidates_examined_;
+    boost::atomic<long> fallbacks_;
+    boost::atomic<long> exact_matches_;
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * A C client of libphomo, which renders a picture with the database given on the
+ * command line: twice in a row, probing every list of its index, cancelled, with
+ * invalid settings and twice at the same time, once of them probing the index. It only prints the checks that fail, so that c_api_test.sh can tell
+ * that the library itself printed nothing.
+ *
+ *     c-api-test <database>
+ */
+
+#include <phomo.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PICTURE_WIDTH 320
+#define PICTURE_HEIGHT 240
+/* As many as c_api_test.sh builds the index with, so probing finds every stone. */
+#define INDEX_LISTS 4
+
+static int failures = 0;
+
+static void check(int condition, const char* description)
+{
+    if(!condition)
+    {
+        fprintf(stderr, "FAILED: %s (last error: %s)\n", description, phomo_last_error());
+        ++failures;
+    }
+}
+
+static unsigned char picture[PICTURE_WIDTH * PICTURE_HEIGHT * 3];
+
+static void paint_picture(void)
+{
+    int x, y;
+    for(y = 0; y < PICTURE_HEIGHT; ++y)
+    {
+        for(x = 0; x < PICTURE_WIDTH; ++x)
+        {
+            unsigned char* pixel = picture + (y * PICTURE_WIDTH + x) * 3;
+            pixel[0] = 255 * x / PICTURE_WIDTH;
+            pixel[1] = 255 * y / PICTURE_HEIGHT;
+            pixel[2] = 128;
+        }
+    }
+}
+
+struct render
+{
+    phomo_database* database;
+    const phomo_render_settings* settings;
+    unsigned char* output;
+    int result;
+};
+
+static void* run_render(void* argument)
+{
+    struct render* render = (struct render*)argument;
+    int output_width, output_height;
+    phomo_output_dimensions(render->database, render->settings, PICTURE_WIDTH, PICTURE_HEIGHT, &output_width, &output_height);
+    render->result = phomo_render(render->database, render->settings, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3,
+            render->output, output_width * 3, NULL, NULL);
+    return NULL;
+}
+
+static int cancel_at_once(double done, void* user_data)
+{
+    ++*(int*)user_data;
+    return 1;
+}
+
+static void check_rejected(phomo_database* database, const phomo_render_settings* settings, unsigned char* output, int output_width,
+        const char* description)
+{
+    int result = phomo_render(database, settings, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3, output, output_width * 3,
+            NULL, NULL);
+    check(result == PHOMO_ERROR && strlen(phomo_last_error()) > 0, description);
+}
+
+int main(int argc, char** argv)
+{
+    phomo_database* database;
+    phomo_render_settings settings, probing, invalid;
+    int output_width, output_height;
+    size_t output_size;
+    unsigned char *first, *second, *concurrent[2];
+    struct render renders[2];
+    pthread_t threads[2];
+    int progress_calls = 0;
+    int i;
+
+    if(argc != 2)
+    {
+        fprintf(stderr, "USAGE: c-api-test <database>\n");
+        return 2;
+    }
+    paint_picture();
+
+    check(phomo_open_database("no-such-database") == NULL && strlen(phomo_last_error()) > 0, "a missing database is reported");
+    database = phomo_open_database(argv[1]);
+    if(database == NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[1], phomo_last_error());
+        return 1;
+    }
+
+    /* One thread and no min-distance make every render of the picture the same. */
+    phomo_default_render_settings(&settings);
+    settings.x_resolution_in_stones = 8;
+    settings.output_width = 320;
+    settings.min_distance = 0;
+    settings.number_of_threads = 1;
+    check(phomo_output_dimensions(database, &settings, PICTURE_WIDTH, PICTURE_HEIGHT, &output_width, &output_height) == PHOMO_OK,
+            "the output dimensions are known");
+    output_size = (size_t)output_width * output_height * 3;
+    first = calloc(output_size, 1);
+    second = calloc(output_size, 1);
+
+    check(phomo_render(database, &settings, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3, first, output_width * 3,
+            NULL, NULL) == PHOMO_OK, "the first render succeeds");
+    check(phomo_render(database, &settings, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3, second, output_width * 3,
+            NULL, NULL) == PHOMO_OK, "the second render succeeds");
+    check(memcmp(first, second, output_size) == 0, "both renders are the same");
+
+    probing = settings;
+    probing.search_probes = INDEX_LISTS;
+    memset(second, 0, output_size);
+    check(phomo_render(database, &probing, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3, second, output_width * 3,
+            NULL, NULL) == PHOMO_OK, "a render probing the index succeeds");
+    check(memcmp(first, second, output_size) == 0, "a render probing every list of the index is the same as the first");
+
+    memset(second, 0, output_size);
+    check(phomo_render(database, &settings, picture, PICTURE_WIDTH, PICTURE_HEIGHT, PICTURE_WIDTH * 3, second, output_width * 3,
+            cancel_at_once, &progress_calls) == PHOMO_CANCELLED, "a render is cancelled by its callback");
+    check(progress_calls == 1, "a cancelled render stops reporting progress");
+
+    invalid = settings;
+    invalid.number_of_threads = 0;
+    check_rejected(database, &invalid, second, output_width, "no threads are rejected");
+    invalid = settings;
+    invalid.prefetch_window = -1;
+    check_rejected(database, &invalid, second, output_width, "a negative prefetch window is rejected");
+    invalid = settings;
+    invalid.x_resolution_in_stones = 0;
+    check_rejected(database, &invalid, second, output_width, "no stones per row are rejected");
+    invalid = settings;
+    invalid.x_resolution_in_stones = PICTURE_WIDTH + 1;
+    check_rejected(database, &invalid, second, output_width, "more stones per row than pixels are rejected");
+    invalid = settings;
+    invalid.time_budget = -1;
+    check_rejected(database, &invalid, second, output_width, "a negative time budget is rejected");
+    check_rejected(database, NULL, second, output_width, "missing settings are rejected");
+    check(phomo_output_dimensions(database, &invalid, PICTURE_WIDTH, PICTURE_HEIGHT, &output_width, &output_height) == PHOMO_ERROR,
+            "invalid settings have no output dimensions");
+
+    for(i = 0; i < 2; ++i)
+    {
+        concurrent[i] = calloc(output_size, 1);
+        renders[i].database = database;
+        renders[i].settings = i == 0 ? &settings : &probing;
+        renders[i].output = concurrent[i];
+        renders[i].result = PHOMO_ERROR;
+        pthread_create(&threads[i], NULL, run_render, &renders[i]);
+    }
+    for(i = 0; i < 2; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        check(renders[i].result == PHOMO_OK, "renders at the same time succeed");
+        check(memcmp(first, concurrent[i], output_size) == 0, "renders at the same time are the same as the first");
+        free(concurrent[i]);
+    }
+
+    free(first);
+    free(second);
+    phomo_close_database(database);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Runs c-api-test against a database of generated photos and its index. The library
+# must not print anything, so any output of the client but its failed checks fails the
+# test too.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+C_API_TEST=${C_API_TEST:-$HERE/c-api-test}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 40 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+"$PHOMO" build-index --database-filename "$WORK_DIR/database" --index-lists 4 > /dev/null
+
+"$C_API_TEST" "$WORK_DIR/database" > "$WORK_DIR/output" 2>&1 || { cat "$WORK_DIR/output" >&2; exit 1; }
+if [ -s "$WORK_DIR/output" ]; then
+    echo "The library printed:" >&2
+    cat "$WORK_DIR/output" >&2
+    exit 1
+fi
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Renders with candidate lists of different lengths and checks that they place the
+# stones the full search places, whether the first candidate is free or min-distance
+# excludes all of them and the tile falls back to the full search.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# One thread places the stones in the same order in every render.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 10 --output-width 400 --min-distance 2 --number-of-threads 1 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 60 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+render --output-filename "$WORK_DIR/full-search.jpg" > /dev/null
+
+for candidates in 1 4 32; do
+    render --candidates-per-tile $candidates --output-filename "$WORK_DIR/candidates-$candidates.jpg" > "$WORK_DIR/log-$candidates"
+    "$TEST_PHOTOS" compare "$WORK_DIR/full-search.jpg" "$WORK_DIR/candidates-$candidates.jpg" 0 > /dev/null \
+        || fail "Lists of $candidates candidates placed other stones than the full search."
+    grep -q "^Found the $candidates closest stones of [0-9]* tiles" "$WORK_DIR/log-$candidates" \
+        || fail "The lists of $candidates candidates are not reported."
+    grep -q "had no candidate list" "$WORK_DIR/log-$candidates" && fail "A tile had no candidate list."
+done
+
+# min-distance 2 excludes up to 24 stones around a tile, more than the shortest lists have.
+FALLBACKS=$(sed -n 's/^\([0-9]*\) of [0-9]* tiles .*fell back to a full search\.$/\1/p' "$WORK_DIR/log-1")
+[ -n "$FALLBACKS" ] && [ "$FALLBACKS" -gt 0 ] || fail "No tile fell back to the full search."
+FALLBACKS=$(sed -n 's/^\([0-9]*\) of [0-9]* tiles .*fell back to a full search\.$/\1/p' "$WORK_DIR/log-32")
+[ "$FALLBACKS" -eq 0 ] || fail "A tile with more candidates than min-distance excludes fell back to the full search."
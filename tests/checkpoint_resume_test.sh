@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Interrupts a render after its last checkpoint, damages the part of the picture the
+# checkpoint does not claim as composited and checks that --resume renders the same
+# mosaic as an uninterrupted render, and that it refuses a checkpoint of other settings.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# One thread and no min-distance make the matches the same in every render.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 8 --output-width 320 --number-of-threads 1 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+render --min-distance 0 --output-filename "$WORK_DIR/full.jpg" > /dev/null
+
+# The render saves a last checkpoint before it writes the mosaic, which cannot be
+# written over a directory, so the checkpoint stays behind.
+mkdir "$WORK_DIR/resumed.jpg"
+render --min-distance 0 --output-filename "$WORK_DIR/resumed.jpg" --checkpoint-interval 60 > /dev/null 2>&1 \
+    && fail "The mosaic was written over a directory."
+rmdir "$WORK_DIR/resumed.jpg"
+CHECKPOINT=$WORK_DIR/resumed.jpg.checkpoint
+[ -f "$CHECKPOINT" ] && [ -f "$CHECKPOINT-image" ] || fail "The interrupted render left no checkpoint."
+
+# The first two rows of stones stay composited, the third is only matched
+# and the rest is not matched. The pixels of all but the first two rows are lost.
+ROWS=$(sed -n 2p "$CHECKPOINT" | cut -d ' ' -f 2)
+[ "$ROWS" -ge 4 ] || fail "The checkpoint has too few rows."
+awk 'NR == 5 { for(i = 1; i <= NF; ++i) $i = -$i } NR > 5 { for(i = 1; i <= NF; ++i) $i = 0 } { print }' \
+    "$CHECKPOINT" > "$WORK_DIR/grid"
+mv "$WORK_DIR/grid" "$CHECKPOINT"
+IMAGE_SIZE=$(wc -c < "$CHECKPOINT-image")
+KEPT=$((IMAGE_SIZE / ROWS * 2))
+dd if=/dev/zero of="$CHECKPOINT-image" bs=1 seek="$KEPT" count=$((IMAGE_SIZE - KEPT)) conv=notrunc 2> /dev/null
+
+render --min-distance 5 --output-filename "$WORK_DIR/resumed.jpg" --resume > /dev/null 2> "$WORK_DIR/error" \
+    && fail "A checkpoint of other settings was resumed."
+grep -q "was written for different settings" "$WORK_DIR/error" || fail "A checkpoint of other settings was resumed."
+
+render --min-distance 0 --output-filename "$WORK_DIR/resumed.jpg" --resume > /dev/null
+"$TEST_PHOTOS" compare "$WORK_DIR/full.jpg" "$WORK_DIR/resumed.jpg" 0 > /dev/null
+[ ! -e "$CHECKPOINT" ] && [ ! -e "$CHECKPOINT-image" ] || fail "The finished render left its checkpoint behind."
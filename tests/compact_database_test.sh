@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Builds a database of photos of which some are copied, and checks that
+# compact-database removes exactly the copies, also when it compacts the database in
+# place.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# The number of stones of a database, without its two header lines.
+stone_count()
+{
+    echo $(($(wc -l < "$1") - 2))
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 12 160 120 1
+for i in 0 1 2 3; do
+    cp "$WORK_DIR/photos/photo$i.jpg" "$WORK_DIR/photos/copy$i.jpg"
+done
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --database-filename "$WORK_DIR/database" > /dev/null
+[ "$(stone_count "$WORK_DIR/database")" -eq 16 ] || fail "The database does not have a stone for every photo."
+
+"$PHOMO" compact-database --database-filename "$WORK_DIR/database" --output-database-filename "$WORK_DIR/compacted" > /dev/null
+[ "$(stone_count "$WORK_DIR/compacted")" -eq 12 ] || fail "compact-database did not remove exactly the copies."
+for i in 0 1 2 3; do
+    [ "$(grep -c -e "/photo$i.jpg|" -e "/copy$i.jpg|" "$WORK_DIR/compacted")" -eq 1 ] || fail "Photo $i and its copy were not merged."
+done
+
+"$PHOMO" compact-database --database-filename "$WORK_DIR/compacted" --output-database-filename "$WORK_DIR/confirmed" \
+    --confirm-with-perceptual-hash > /dev/null
+[ "$(stone_count "$WORK_DIR/confirmed")" -eq 12 ] || fail "The perceptual hash removed photos that are not copies."
+
+"$PHOMO" compact-database --database-filename "$WORK_DIR/database" --output-database-filename "$WORK_DIR/database" > /dev/null
+cmp -s "$WORK_DIR/database" "$WORK_DIR/compacted" || fail "Compacting in place differs from compacting into another file."
+[ ! -e "$WORK_DIR/database.tmp" ] || fail "Compacting in place left its temporary file behind."
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Builds the databases of two aspect ratios and two raster resolutions from one pass
+# over the photos and checks that every variant has the stones a build of just that
+# variant has, and that render picks the variant its options ask for.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+build_database()
+{
+    "$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" "$@" > /dev/null
+}
+
+# The order of the stones depends on the threads that find the photos, not their content.
+same_stones()
+{
+    sort "$1" > "$WORK_DIR/a"
+    sort "$2" > "$WORK_DIR/b"
+    cmp -s "$WORK_DIR/a" "$WORK_DIR/b"
+}
+
+# One thread and no min-distance make the matches the same in every render.
+render()
+{
+    "$PHOMO" render --picture-path "$WORK_DIR/photos/photo0.jpg" --x-resolution-in-stones 8 --output-width 320 \
+        --min-distance 0 --number-of-threads 1 "$@" > /dev/null
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 20 160 120 1
+build_database --aspect-ratio 4x3,1x1 --raster-resolution 3,5 --database-filename "$WORK_DIR/variants"
+[ "$(tail -n +2 "$WORK_DIR/variants" | wc -l)" -eq 4 ] || fail "The manifest does not list every variant."
+
+for aspect_ratio in 4x3 1x1; do
+    for raster_resolution in 3 5; do
+        variant=$WORK_DIR/variants.$aspect_ratio-$raster_resolution
+        build_database --aspect-ratio $aspect_ratio --raster-resolution $raster_resolution \
+            --database-filename "$WORK_DIR/single"
+        same_stones "$WORK_DIR/single" "$variant" \
+            || fail "The $aspect_ratio variant of raster resolution $raster_resolution differs from a build of its own."
+    done
+done
+
+render --database-filename "$WORK_DIR/single" --aspect-ratio 1x1 --raster-resolution 5 --output-filename "$WORK_DIR/single.jpg"
+render --database-filename "$WORK_DIR/variants" --aspect-ratio 1x1 --raster-resolution 5 --output-filename "$WORK_DIR/variant.jpg"
+"$TEST_PHOTOS" compare "$WORK_DIR/single.jpg" "$WORK_DIR/variant.jpg" 0 > /dev/null
+
+render --database-filename "$WORK_DIR/variants" --aspect-ratio 3x2 --raster-resolution 5 --output-filename "$WORK_DIR/missing.jpg" \
+    2> "$WORK_DIR/error" && fail "A variant that was not built was rendered."
+grep -q "No variant of" "$WORK_DIR/error" || fail "A missing variant is not reported."
+
+"$PHOMO" build-index --database-filename "$WORK_DIR/variants" --index-lists 2 > /dev/null
+for variant in 4x3-3 4x3-5 1x1-3 1x1-5; do
+    [ -f "$WORK_DIR/variants.$variant.ivf" ] || fail "build-index skipped the $variant variant."
+done
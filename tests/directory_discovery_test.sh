@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Builds a database from a tree of directories with one discovery thread and with
+# many, which must find the same photos, and only the photos.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+for directory in a a/b a/b/c d e/f; do
+    "$TEST_PHOTOS" generate "$WORK_DIR/photos/$directory" 3 64 48 1
+done
+echo "not a photo" > "$WORK_DIR/photos/a/notes.txt"
+mkdir "$WORK_DIR/photos/empty"
+
+for threads in 1 8; do
+    "$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --discovery-threads $threads \
+        --database-filename "$WORK_DIR/database-$threads" > /dev/null
+    sed 1,2d "$WORK_DIR/database-$threads" | cut -d '|' -f 1 | sort > "$WORK_DIR/paths-$threads"
+done
+[ "$(wc -l < "$WORK_DIR/paths-1")" -eq 15 ] || fail "Not every photo was found."
+cmp -s "$WORK_DIR/paths-1" "$WORK_DIR/paths-8" || fail "More discovery threads found other photos."
+
+if "$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --discovery-threads 0 \
+        --database-filename "$WORK_DIR/database-0" > /dev/null 2>&1; then
+    fail "No discovery threads were accepted."
+fi
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Distributes a mosaic to local worker processes and to a render-worker listening on a
+# port, and checks that both give the mosaic a single process renders.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+WORKER_PID=
+trap '[ -z "$WORKER_PID" ] || kill "$WORKER_PID"; rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# No min-distance makes the matches the same however the mosaic is split up.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 8 --output-width 320 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+render --min-distance 0 --number-of-threads 1 --output-filename "$WORK_DIR/local.jpg" > /dev/null
+
+render --min-distance 0 --local-workers 3 --output-filename "$WORK_DIR/local-workers.jpg" > /dev/null
+"$TEST_PHOTOS" compare "$WORK_DIR/local.jpg" "$WORK_DIR/local-workers.jpg" 0 > /dev/null
+
+# Another test may hold a port, so the worker tries a few.
+for PORT in 17071 17171 17271 17371 17471; do
+    "$PHOMO" render-worker --database-filename "$WORK_DIR/database" --listen-port $PORT > "$WORK_DIR/worker.log" 2>&1 &
+    WORKER_PID=$!
+    while kill -0 "$WORKER_PID" 2> /dev/null && ! grep -q "^Waiting for coordinators" "$WORK_DIR/worker.log"; do
+        sleep 0.1
+    done
+    if kill -0 "$WORKER_PID" 2> /dev/null; then
+        break
+    fi
+    WORKER_PID=
+done
+[ -n "$WORKER_PID" ] || fail "render-worker found no port to listen on."
+render --min-distance 0 --workers 127.0.0.1:$PORT --local-workers 1 --output-filename "$WORK_DIR/workers.jpg" > /dev/null
+"$TEST_PHOTOS" compare "$WORK_DIR/local.jpg" "$WORK_DIR/workers.jpg" 0 > /dev/null
+
+# A min-distance reaches across the rows of different workers.
+render --min-distance 2 --local-workers 3 --output-filename "$WORK_DIR/min-distance.jpg" > /dev/null
+
+render --min-distance 0 --local-workers 2 --time-budget 5 --output-filename "$WORK_DIR/budget.jpg" > /dev/null 2>&1 \
+    && fail "A distributed render accepted a time budget."
+[ ! -e "$WORK_DIR/budget.jpg" ] || fail "A distributed render accepted a time budget."
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Saves the layout of a render and composites it again with render-layout, at the
+# same and at another output size, and checks the result against renders of the
+# picture. Also checks that cells without a stone are left empty and that a layout is
+# refused once its database has changed.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# One thread and no min-distance make the matches the same at every output size.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 8 --min-distance 0 --number-of-threads 1 "$@" > /dev/null
+}
+
+render_layout()
+{
+    "$PHOMO" render-layout --layout-filename "$WORK_DIR/layout" "$@" > /dev/null
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+render --output-width 320 --output-filename "$WORK_DIR/small.jpg" --layout-filename "$WORK_DIR/layout"
+render --output-width 640 --output-filename "$WORK_DIR/big.jpg"
+
+render_layout --output-width 320 --output-filename "$WORK_DIR/small-layout.jpg"
+"$TEST_PHOTOS" compare "$WORK_DIR/small.jpg" "$WORK_DIR/small-layout.jpg" 0 > /dev/null \
+    || fail "The layout composited at the same size differs from the render."
+render_layout --output-width 640 --output-filename "$WORK_DIR/big-layout.jpg" --number-of-threads 4
+"$TEST_PHOTOS" compare "$WORK_DIR/big.jpg" "$WORK_DIR/big-layout.jpg" 0 > /dev/null \
+    || fail "The layout composited at another size differs from a render at that size."
+
+# The header takes four lines, the first row of stones is left empty.
+cp "$WORK_DIR/layout" "$WORK_DIR/full-layout"
+awk 'NR == 5 { for(i = 1; i <= NF; ++i) $i = -1 } { print }' "$WORK_DIR/full-layout" > "$WORK_DIR/layout"
+render_layout --output-width 320 --output-filename "$WORK_DIR/empty-row.jpg"
+"$TEST_PHOTOS" compare "$WORK_DIR/small.jpg" "$WORK_DIR/empty-row.jpg" 0 > /dev/null 2>&1 \
+    && fail "The cells without a stone were composited."
+"$TEST_PHOTOS" compare "$WORK_DIR/small.jpg" "$WORK_DIR/empty-row.jpg" 100 > /dev/null
+
+cp "$WORK_DIR/full-layout" "$WORK_DIR/layout"
+sed -n 3p "$WORK_DIR/database" >> "$WORK_DIR/database"
+render_layout --output-width 320 --output-filename "$WORK_DIR/changed.jpg" 2> "$WORK_DIR/error" \
+    && fail "A layout of a database that has changed was composited."
+grep -q "has changed since the layout was saved" "$WORK_DIR/error" || fail "A changed database is not reported."
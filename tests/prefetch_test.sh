@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Renders the same mosaic without read-ahead and with read-ahead windows of several
+# sizes, with one thread and with several. Without min-distance every tile gets the
+# same stone in every render, so the mosaics must be the same.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 20 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+
+for threads in 1 4; do
+    for window in 0 1 16; do
+        "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+            --output-filename "$WORK_DIR/mosaic-$threads-$window.jpg" --x-resolution-in-stones 8 --output-width 320 \
+            --min-distance 0 --number-of-threads $threads --prefetch-window $window > /dev/null
+        "$TEST_PHOTOS" compare "$WORK_DIR/mosaic-1-0.jpg" "$WORK_DIR/mosaic-$threads-$window.jpg" 0 > /dev/null
+    done
+done
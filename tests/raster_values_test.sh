@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# build-database averages the raster cells of a photo in one pass over its rows, render
+# averages the cells of a tile of the picture in another. Renders every photo as a
+# mosaic of a single stone and checks that the two agree: the stone is the photo itself.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 12 160 120 1
+for raster_resolution in 3 5; do
+    "$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+        --raster-resolution $raster_resolution --database-filename "$WORK_DIR/database" > /dev/null
+    for photo in 0 5 11; do
+        "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo$photo.jpg" \
+            --x-resolution-in-stones 1 --output-width 160 --min-distance 0 --number-of-threads 1 \
+            --output-filename "$WORK_DIR/mosaic.jpg" > /dev/null
+        # The photo is encoded once more as the mosaic.
+        "$TEST_PHOTOS" compare "$WORK_DIR/photos/photo$photo.jpg" "$WORK_DIR/mosaic.jpg" 3 > /dev/null \
+            || fail "photo$photo.jpg did not match itself at raster resolution $raster_resolution."
+    done
+done
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Every render thread reuses its buffers for all of its tiles. Renders stones of
+# different sizes, with and without the tile atlas, on one and on several threads,
+# which hand the buffers different sequences of tiles, and checks that the mosaics
+# are the same. Also checks that a negative prefetch window, which sizes a buffer, is
+# rejected.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# No min-distance makes the matches the same on any number of threads.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/small/photo0.jpg" \
+        --x-resolution-in-stones 12 --output-width 480 --min-distance 0 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos/small" 15 80 60 1
+"$TEST_PHOTOS" generate "$WORK_DIR/photos/big" 15 400 300 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+
+for source in photos atlas; do
+    render --number-of-threads 1 --output-filename "$WORK_DIR/$source-1.jpg" > /dev/null
+    render --number-of-threads 4 --prefetch-window 2 --output-filename "$WORK_DIR/$source-4.jpg" > /dev/null
+    "$TEST_PHOTOS" compare "$WORK_DIR/$source-1.jpg" "$WORK_DIR/$source-4.jpg" 0 > /dev/null \
+        || fail "Rendering from the $source on 4 threads changed the mosaic."
+    "$PHOMO" build-atlas --database-filename "$WORK_DIR/database" --atlas-tile-widths 16,64 > /dev/null
+done
+
+render --prefetch-window -1 --output-filename "$WORK_DIR/negative.jpg" > /dev/null 2>&1 \
+    && fail "A negative prefetch window was accepted."
+[ ! -e "$WORK_DIR/negative.jpg" ] || fail "A negative prefetch window was accepted."
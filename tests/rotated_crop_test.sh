@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Renders the same mosaic from stones with the crops build-database stores and from
+# the same stones without them, which render has to probe, for photos in every EXIF
+# orientation at an aspect ratio that is not square. The stones are as big as their
+# crops, so that both decode them at full scale and the mosaics must match.
+#
+# ORIENTATIONS selects the orientations that are tested, e.g.
+#
+#     ORIENTATIONS="6 8" ./rotated_crop_test.sh
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+ORIENTATIONS=${ORIENTATIONS:-"1 3 6 8"}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+for orientation in $ORIENTATIONS; do
+    photos=$WORK_DIR/photos-$orientation
+    "$TEST_PHOTOS" generate "$photos" 12 480 240 "$orientation"
+    database=$WORK_DIR/database-$orientation
+    "$PHOMO" build-database --input-type directory --photos-dir "$photos" --aspect-ratio 4x3 \
+        --database-filename "$database" > /dev/null
+    # The first 28 fields are the path and the 27 raster values of raster resolution 3.
+    cut -d '|' -f 1-28 "$database" > "$database-probed"
+
+    # One thread and no min-distance make the matches the same in both renders.
+    for variant in "$database" "$database-probed"; do
+        "$PHOMO" render --database-filename "$variant" --picture-path "$photos/photo0.jpg" \
+            --output-filename "$variant.jpg" --x-resolution-in-stones 4 --output-width 960 \
+            --min-distance 0 --number-of-threads 1 > "$variant.log"
+    done
+    if ! grep -q "stone photos were probed" "$database-probed.log" || grep -q "stone photos were probed" "$database.log"; then
+        echo "Orientation $orientation: the renders did not take the intended paths." >&2
+        exit 1
+    fi
+    "$TEST_PHOTOS" compare "$database.jpg" "$database-probed.jpg" 1
+done
+
+# Stones whose photos were damaged after the database was built are reported and left
+# empty, and the decoder they leave behind must not use up the file descriptors.
+for photo in "$photos"/*.jpg; do
+    cp -p "$photo" "$WORK_DIR/stamp"
+    printf 'XX' | dd of="$photo" conv=notrunc 2> /dev/null
+    touch -r "$WORK_DIR/stamp" "$photo"
+done
+(
+    ulimit -n 20
+    "$PHOMO" render --database-filename "$database" --picture-path "$WORK_DIR/stamp" \
+        --output-filename "$WORK_DIR/damaged.jpg" --x-resolution-in-stones 16 --output-width 960 --min-distance 0 \
+        --number-of-threads 2 > "$WORK_DIR/damaged.log" 2>&1
+) || { cat "$WORK_DIR/damaged.log" >&2; exit 1; }
+if ! grep -q "Not a JPEG file" "$WORK_DIR/damaged.log" || [ ! -s "$WORK_DIR/damaged.jpg" ]; then
+    echo "The damaged stone photos were not reported and skipped." >&2
+    exit 1
+fi
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Checks that generate-corpus gives the same corpus for the same seed and runs the
+# scaling benchmark on a tiny corpus. The test checks the report, not the timings,
+# so a stand-in for GNU time records the same numbers for every run.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+GENERATE_CORPUS=${GENERATE_CORPUS:-$HERE/../performance-tests/generate-corpus}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+generate()
+{
+    "$GENERATE_CORPUS" --output-dir "$WORK_DIR/$1" --count 6 --width 160 --height 120 --seed "$2" > /dev/null
+}
+generate first 7
+generate second 7
+generate other 8
+[ "$(ls "$WORK_DIR/first" | wc -l)" -eq 6 ] || fail "generate-corpus did not write every photo."
+for photo in "$WORK_DIR"/first/*; do
+    cmp -s "$photo" "$WORK_DIR/second/$(basename "$photo")" || fail "The same seed gave another corpus."
+done
+cmp -s "$WORK_DIR/first/photo0.jpg" "$WORK_DIR/other/photo0.jpg" && fail "Another seed gave the same corpus."
+
+# Called as: time -f <format> -o <file> <command...>
+cat > "$WORK_DIR/time" <<'TIME'
+#!/bin/sh
+output=$4
+shift 4
+"$@"
+echo "2.00,3.00,0.50,1000" > "$output"
+TIME
+chmod +x "$WORK_DIR/time"
+
+BENCHMARK_DIR=$WORK_DIR/benchmark
+PHOMO=$PHOMO GENERATE_CORPUS=$GENERATE_CORPUS GNU_TIME=$WORK_DIR/time RESULTS_DIR=$BENCHMARK_DIR/results \
+    WORK_DIR=$BENCHMARK_DIR CORPUS_SIZE=30 PHOTO_WIDTH=160 PHOTO_HEIGHT=120 THREADS="1 2" \
+    RASTER_RESOLUTIONS=3 X_RESOLUTIONS_IN_STONES=8 MIN_DISTANCES=0 SEARCH_PROBES="0 2" INDEX_LISTS=4 OUTPUT_WIDTH=320 \
+    "$HERE/../performance-tests/scaling_benchmark.sh" > /dev/null
+REPORT=$(ls "$BENCHMARK_DIR"/results/scaling-*.csv)
+head -n 1 "$REPORT" | grep -q "^commit,action,threads,.*,wall_seconds,.*,recall_percent,speedup$" \
+    || fail "The report has no header."
+[ "$(grep -c ",build-database,[12],3,-,-,-,2.00,3.00,0.50,1000,-,1.00$" "$REPORT")" -eq 2 ] \
+    || fail "The report does not have a row for every build."
+[ "$(grep -c ",render,[12],3,8,0,0,2.00,3.00,0.50,1000,-,1.00$" "$REPORT")" -eq 2 ] \
+    || fail "The report does not have a row for every exact render."
+[ "$(grep -c ",render,[12],3,8,0,2,2.00,3.00,0.50,1000,[0-9.]*,1.00$" "$REPORT")" -eq 2 ] \
+    || fail "The report does not have the recall of every approximate render."
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Builds the approximate search index of a database and checks that searching all of
+# its lists finds the same matches as the exact search, and that render rejects an
+# index which does not fit the database or is damaged instead of reading past it.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# One thread and no min-distance make the matches the same in every render.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 8 --output-width 320 --min-distance 0 --number-of-threads 1 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 40 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+"$PHOMO" build-index --database-filename "$WORK_DIR/database" --index-lists 4 > /dev/null
+[ -f "$WORK_DIR/database.ivf" ] || fail "build-index wrote no index."
+
+render --output-filename "$WORK_DIR/exact.jpg" > /dev/null
+render --output-filename "$WORK_DIR/all-lists.jpg" --search-probes 4 --benchmark-recall > "$WORK_DIR/log"
+grep -q "^Recall of the approximate search: 100%$" "$WORK_DIR/log" || fail "Searching all lists missed exact matches."
+"$TEST_PHOTOS" compare "$WORK_DIR/exact.jpg" "$WORK_DIR/all-lists.jpg" 0 > /dev/null
+render --output-filename "$WORK_DIR/one-list.jpg" --search-probes 1 > /dev/null
+
+cp "$WORK_DIR/database.ivf" "$WORK_DIR/index"
+expect_rejected()
+{
+    render --output-filename "$WORK_DIR/rejected.jpg" --search-probes 1 > /dev/null 2> "$WORK_DIR/error" \
+        && fail "$1"
+    grep -q "Rebuild it with build-index" "$WORK_DIR/error" || fail "$1"
+    cp "$WORK_DIR/index" "$WORK_DIR/database.ivf"
+}
+
+# The header gives the number of lists, values per centroid, stones and the database checksum.
+sed '1s/^\([0-9]*\) [0-9]*/\1 12/' "$WORK_DIR/index" > "$WORK_DIR/database.ivf"
+expect_rejected "An index with centroids of another raster resolution was accepted."
+head -n 4 "$WORK_DIR/index" > "$WORK_DIR/database.ivf"
+expect_rejected "A truncated index was accepted."
+sed '2s/|[^|]*$//' "$WORK_DIR/index" > "$WORK_DIR/database.ivf"
+expect_rejected "An index with a short centroid was accepted."
+sed '1s/^[0-9]*/1000/' "$WORK_DIR/index" > "$WORK_DIR/database.ivf"
+expect_rejected "An index with more lists than stones was accepted."
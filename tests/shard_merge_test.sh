@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Builds the same database in the ways build-database offers and checks that they
+# agree: at once, as two shards merged with merge-database and resumed from a
+# database whose build was interrupted. Then renders the same mosaic from the full and
+# the merged database.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+build_database()
+{
+    "$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 "$@" > /dev/null
+}
+
+# The order of the stones depends on the threads that find the photos, not their content.
+same_stones()
+{
+    sort "$1" > "$WORK_DIR/a"
+    sort "$2" > "$WORK_DIR/b"
+    cmp -s "$WORK_DIR/a" "$WORK_DIR/b"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+build_database --database-filename "$WORK_DIR/full"
+[ "$(wc -l < "$WORK_DIR/full")" -eq 32 ] || fail "The database does not have a stone for every photo."
+
+build_database --database-filename "$WORK_DIR/shard0" --shard-count 2 --shard-index 0
+build_database --database-filename "$WORK_DIR/shard1" --shard-count 2 --shard-index 1
+[ "$(wc -l < "$WORK_DIR/shard0")" -lt 32 ] && [ "$(wc -l < "$WORK_DIR/shard1")" -lt 32 ] || fail "A shard has all photos."
+"$PHOMO" merge-database --input-database "$WORK_DIR/shard0" --input-database "$WORK_DIR/shard1" \
+    --output-database-filename "$WORK_DIR/merged" > /dev/null
+same_stones "$WORK_DIR/full" "$WORK_DIR/merged" || fail "The merged shards differ from the full database."
+
+# Merging into one of the inputs, and merging a stone twice, keeps every stone once.
+"$PHOMO" merge-database --input-database "$WORK_DIR/shard0" --input-database "$WORK_DIR/merged" \
+    --output-database-filename "$WORK_DIR/shard0" > /dev/null
+same_stones "$WORK_DIR/full" "$WORK_DIR/shard0" || fail "Merging into an input lost or repeated stones."
+
+# An interrupted build leaves some stones and a truncated last line behind.
+head -n 12 "$WORK_DIR/full" > "$WORK_DIR/resumed"
+sed -n 13p "$WORK_DIR/full" | cut -c 1-20 | tr -d '\n' >> "$WORK_DIR/resumed"
+build_database --database-filename "$WORK_DIR/resumed" --resume 2> /dev/null
+same_stones "$WORK_DIR/full" "$WORK_DIR/resumed" || fail "The resumed database differs from the full database."
+
+# One thread and no min-distance make the matches the same in every render.
+render()
+{
+    "$PHOMO" render --picture-path "$WORK_DIR/photos/photo0.jpg" --x-resolution-in-stones 8 --output-width 320 \
+        --min-distance 0 --number-of-threads 1 "$@" > /dev/null
+}
+render --database-filename "$WORK_DIR/full" --output-filename "$WORK_DIR/full.jpg"
+render --database-filename "$WORK_DIR/merged" --output-filename "$WORK_DIR/merged.jpg"
+"$TEST_PHOTOS" compare "$WORK_DIR/full.jpg" "$WORK_DIR/merged.jpg" 0 > /dev/null
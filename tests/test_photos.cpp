@@ -0,0 +1,176 @@
+/*
+ * phomo Photomosaic Creator
+ * Copyright (C) 2009  Peter Goetz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Photos for the tests, and a comparison of the mosaics they render.
+ *
+ *     test-photos generate <dir> <count> <width> <height> <orientation>
+ *
+ * writes photo0.jpg ... to dir, which are width x height when displayed. With an EXIF
+ * orientation of 6 or 8 they are stored with width and height swapped, as a camera
+ * stores them. No two photos are alike, and none of them looks the same when rotated.
+ *
+ *     test-photos compare <a.jpg> <b.jpg> <max-mean-difference>
+ *
+ * fails unless both pictures have the same size and their channels differ by at most
+ * max-mean-difference on average.
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <boost/gil/image.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <boost/gil/extension/io/jpeg_dynamic_io.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/cstdint.hpp>
+
+#include <exiv2/image.hpp>
+
+namespace gil = boost::gil;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using boost::lexical_cast;
+
+int usage()
+{
+    cerr << "USAGE:" << endl
+         << "test-photos generate <dir> <count> <width> <height> <orientation>" << endl
+         << "test-photos compare <a.jpg> <b.jpg> <max-mean-difference>" << endl;
+    return 2;
+}
+
+/// A gradient in the colour of the photo with a bright block in its top left quarter.
+void paint_photo(const gil::rgb8_view_t& view, int number)
+{
+    // srand(0) seeds like srand(1).
+    srand(number + 1);
+    int red = rand() % 256, green = rand() % 256, blue = rand() % 256;
+    for(int y = 0; y < view.height(); ++y)
+    {
+        for(int x = 0; x < view.width(); ++x)
+        {
+            view(x, y) = gil::rgb8_pixel_t((red + 192 * x / view.width()) % 256,
+                                           (green + 192 * y / view.height()) % 256,
+                                           blue);
+        }
+    }
+    gil::fill_pixels(gil::subimage_view(view, view.width() / 8, view.height() / 8, view.width() / 4, view.height() / 4),
+            gil::rgb8_pixel_t(255, 255, 255));
+}
+
+/// The stored pixel of the displayed pixel (x, y) of a photo of displayed size width x height.
+gil::point2<std::ptrdiff_t> stored_position(int x, int y, int width, int height, int orientation)
+{
+    switch(orientation)
+    {
+    case 3: return gil::point2<std::ptrdiff_t>(width - 1 - x, height - 1 - y);
+    case 6: return gil::point2<std::ptrdiff_t>(y, width - 1 - x);
+    case 8: return gil::point2<std::ptrdiff_t>(height - 1 - y, x);
+    default: return gil::point2<std::ptrdiff_t>(x, y);
+    }
+}
+
+void write_orientation(const string& path, int orientation)
+{
+    Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(path);
+    image->readMetadata();
+    Exiv2::ExifData& exif_data = image->exifData();
+    exif_data["Exif.Image.Orientation"] = boost::uint16_t(orientation);
+    image->writeMetadata();
+}
+
+int generate(const string& output_dir, int count, int width, int height, int orientation)
+{
+    filesystem::create_directories(output_dir);
+    bool swapped = orientation == 6 or orientation == 8;
+    for(int i = 0; i < count; ++i)
+    {
+        gil::rgb8_image_t displayed(width, height);
+        paint_photo(view(displayed), i);
+        gil::rgb8_image_t stored(swapped ? height : width, swapped ? width : height);
+        for(int y = 0; y < height; ++y)
+        {
+            for(int x = 0; x < width; ++x)
+            {
+                view(stored)(stored_position(x, y, width, height, orientation)) = const_view(displayed)(x, y);
+            }
+        }
+        string path = output_dir + "/photo" + lexical_cast<string>(i) + ".jpg";
+        gil::jpeg_write_view(path, view(stored), 95);
+        if(orientation != 1)
+        {
+            write_orientation(path, orientation);
+        }
+    }
+    return 0;
+}
+
+int compare(const string& a_path, const string& b_path, double max_mean_difference)
+{
+    gil::rgb8_image_t a, b;
+    gil::jpeg_read_image(a_path, a);
+    gil::jpeg_read_image(b_path, b);
+    if(a.dimensions() != b.dimensions())
+    {
+        cerr << a_path << " and " << b_path << " differ in size." << endl;
+        return 1;
+    }
+    double difference = 0;
+    for(int y = 0; y < a.height(); ++y)
+    {
+        for(int x = 0; x < a.width(); ++x)
+        {
+            for(int channel = 0; channel < 3; ++channel)
+            {
+                difference += abs(const_view(a)(x, y)[channel] - const_view(b)(x, y)[channel]);
+            }
+        }
+    }
+    difference /= 3.0 * a.width() * a.height();
+    cout << "Mean difference of " << a_path << " and " << b_path << ": " << difference << endl;
+    return difference <= max_mean_difference ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if(argc == 7 and string(argv[1]) == "generate")
+        {
+            return generate(argv[2], lexical_cast<int>(argv[3]), lexical_cast<int>(argv[4]), lexical_cast<int>(argv[5]),
+                    lexical_cast<int>(argv[6]));
+        }
+        if(argc == 5 and string(argv[1]) == "compare")
+        {
+            return compare(argv[2], argv[3], lexical_cast<double>(argv[4]));
+        }
+    }
+    catch(std::exception& error)
+    {
+        cerr << "Error: " << error.what() << endl;
+        return 1;
+    }
+    return usage();
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Renders a mosaic with stones from the tile atlas and from the original photos and
+# checks that they look alike, and that an atlas which is truncated or belongs to
+# another database is not used.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+# No min-distance makes the matches the same in every render.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/photos/photo0.jpg" \
+        --x-resolution-in-stones 8 --output-width 320 --min-distance 0 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+render --output-filename "$WORK_DIR/photos.jpg" > /dev/null
+"$PHOMO" build-atlas --database-filename "$WORK_DIR/database" --atlas-tile-widths 32,64 > /dev/null
+[ -f "$WORK_DIR/database.atlas" ] || fail "build-atlas wrote no atlas."
+
+render --output-filename "$WORK_DIR/atlas.jpg" > "$WORK_DIR/log"
+grep -q "^Took [0-9]* stones from the tile atlas" "$WORK_DIR/log" || fail "The render did not use the atlas."
+# The tiles are scaled twice, so the mosaics are not the same to the pixel.
+"$TEST_PHOTOS" compare "$WORK_DIR/photos.jpg" "$WORK_DIR/atlas.jpg" 8 > /dev/null
+render --output-filename "$WORK_DIR/ignored.jpg" --ignore-atlas > "$WORK_DIR/log"
+grep -q "tile atlas" "$WORK_DIR/log" && fail "--ignore-atlas used the atlas."
+"$TEST_PHOTOS" compare "$WORK_DIR/photos.jpg" "$WORK_DIR/ignored.jpg" 0 > /dev/null
+
+cp "$WORK_DIR/database.atlas" "$WORK_DIR/atlas"
+expect_photos_used()
+{
+    render --output-filename "$WORK_DIR/fallback.jpg" > "$WORK_DIR/log" 2> "$WORK_DIR/error"
+    grep -q "$1.* ==> using the original photos" "$WORK_DIR/error" || fail "The render used a bad atlas."
+    "$TEST_PHOTOS" compare "$WORK_DIR/photos.jpg" "$WORK_DIR/fallback.jpg" 0 > /dev/null
+    cp "$WORK_DIR/atlas" "$WORK_DIR/database.atlas"
+}
+head -c 20000 "$WORK_DIR/atlas" > "$WORK_DIR/database.atlas"
+expect_photos_used "is truncated"
+"$TEST_PHOTOS" generate "$WORK_DIR/other-photos" 20 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/other-photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/other" > /dev/null
+"$PHOMO" build-atlas --database-filename "$WORK_DIR/other" --atlas-tile-widths 64 > /dev/null
+cp "$WORK_DIR/other.atlas" "$WORK_DIR/database.atlas"
+expect_photos_used "does not belong to the database"
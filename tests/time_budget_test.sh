@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Renders the same mosaic with and without --time-budget: a budget that is long enough
+# leaves every tile as it is, one that is used up at once paints every tile with the
+# raster cells of its stone. Tiles whose stone photo cannot be read at all are reported
+# as errors and never as decoded at low resolution, however far behind the render is.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 40 320 240 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" > /dev/null
+cp "$WORK_DIR/photos/photo0.jpg" "$WORK_DIR/picture.jpg"
+
+# One thread and no min-distance make the matches the same in every render.
+render()
+{
+    "$PHOMO" render --database-filename "$WORK_DIR/database" --picture-path "$WORK_DIR/picture.jpg" \
+        --min-distance 0 --number-of-threads 1 "$@"
+}
+
+render --output-filename "$WORK_DIR/plain.jpg" --x-resolution-in-stones 8 --output-width 640 > /dev/null
+render --output-filename "$WORK_DIR/budget.jpg" --x-resolution-in-stones 8 --output-width 640 --time-budget 600 \
+    --degraded-tiles-filename "$WORK_DIR/budget.tiles" > "$WORK_DIR/budget.log"
+grep -q "Time budget: 0 of 64 tiles were degraded" "$WORK_DIR/budget.log" || fail "A long time budget degraded tiles."
+[ ! -s "$WORK_DIR/budget.tiles" ] || fail "A long time budget listed degraded tiles."
+"$TEST_PHOTOS" compare "$WORK_DIR/plain.jpg" "$WORK_DIR/budget.jpg" 0 > /dev/null
+
+render --output-filename "$WORK_DIR/late.jpg" --x-resolution-in-stones 8 --output-width 640 --time-budget 0.001 \
+    --degraded-tiles-filename "$WORK_DIR/late.tiles" > "$WORK_DIR/late.log"
+grep -q "Time budget: 64 of 64 tiles were degraded, 64 by a partial search, 0 by low resolution sources and 64 by raster cells" \
+    "$WORK_DIR/late.log" || fail "A used up time budget did not paint every tile with raster cells."
+[ "$(grep -c "partial-search,raster-cells$" "$WORK_DIR/late.tiles")" -eq 64 ] || fail "Not every degraded tile was listed."
+[ -s "$WORK_DIR/late.jpg" ] || fail "A used up time budget wrote no mosaic."
+
+# Damaged photos with their old stamps take the path of the stored crops and fail to decode.
+for photo in "$WORK_DIR"/photos/*.jpg; do
+    cp -p "$photo" "$WORK_DIR/stamp"
+    printf 'XX' | dd of="$photo" conv=notrunc 2> /dev/null
+    touch -r "$WORK_DIR/stamp" "$photo"
+done
+render --output-filename "$WORK_DIR/damaged.jpg" --x-resolution-in-stones 8 --output-width 640 > "$WORK_DIR/damaged.log" 2>&1
+grep -q "Not a JPEG file" "$WORK_DIR/damaged.log" || fail "The damaged stone photos were not reported."
+# Whether a budget leaves the render behind depends on the machine, so try several.
+for budget in 0.06 0.08 0.1 0.12 0.15 0.2 0.3; do
+    render --output-filename "$WORK_DIR/damaged.jpg" --x-resolution-in-stones 40 --output-width 1600 --time-budget "$budget" \
+        --degraded-tiles-filename "$WORK_DIR/damaged.tiles" > /dev/null 2>&1
+    ! grep -q "low-resolution" "$WORK_DIR/damaged.tiles" || fail "Stones that failed to decode were reported at low resolution."
+done
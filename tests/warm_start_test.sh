@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# The warm start tries stones in another order than the database. Checks that it still
+# finds the match a search of the whole database finds: of stones that match alike,
+# the one first in the database, whichever order and however many threads try them.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+PHOMO=${PHOMO:-$HERE/../src/phomo}
+TEST_PHOTOS=${TEST_PHOTOS:-$HERE/test-photos}
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+fail()
+{
+    echo "$1" >&2
+    exit 1
+}
+
+render()
+{
+    "$PHOMO" render --picture-path "$WORK_DIR/photos/photo0.jpg" --x-resolution-in-stones 8 --output-width 320 \
+        --min-distance 0 "$@"
+}
+
+"$TEST_PHOTOS" generate "$WORK_DIR/photos" 30 160 120 1
+"$PHOMO" build-database --input-type directory --photos-dir "$WORK_DIR/photos" --aspect-ratio 4x3 \
+    --database-filename "$WORK_DIR/database" --number-of-threads 1 > /dev/null
+render --database-filename "$WORK_DIR/database" --output-filename "$WORK_DIR/mosaic.jpg" > "$WORK_DIR/log"
+grep -q "^Warm start tried .* stones per search" "$WORK_DIR/log" || fail "The warm start is not reported."
+
+# Every stone gets the raster values of the first one, so that all of them match every
+# tile alike and only the first one may be chosen.
+head -n 3 "$WORK_DIR/database" > "$WORK_DIR/first"
+FIRST_VALUES=$(sed -n 3p "$WORK_DIR/database" | cut -d '|' -f 2-)
+head -n 2 "$WORK_DIR/database" > "$WORK_DIR/alike"
+tail -n +3 "$WORK_DIR/database" | cut -d '|' -f 1 | sed "s/\$/|$FIRST_VALUES/" >> "$WORK_DIR/alike"
+
+render --database-filename "$WORK_DIR/first" --output-filename "$WORK_DIR/first.jpg" --number-of-threads 1 > /dev/null
+for threads in 1 4; do
+    render --database-filename "$WORK_DIR/alike" --output-filename "$WORK_DIR/alike-$threads.jpg" \
+        --number-of-threads $threads > /dev/null
+    "$TEST_PHOTOS" compare "$WORK_DIR/first.jpg" "$WORK_DIR/alike-$threads.jpg" 0 > /dev/null \
+        || fail "A stone later in the database won a tie with $threads threads."
+done